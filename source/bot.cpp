@@ -4,14 +4,39 @@
 #include <chrono>
 #include <algorithm>
 #include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <atomic>
+#include <new>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "json.hpp"
 
 #pragma GCC optimize("Ofast")
 
 using json = nlohmann::json;
-static const int BOARD_SIZE = 10;
-static char boardArr[BOARD_SIZE][BOARD_SIZE];
-static char myPlayer, oppPlayer;
+// Board size and win length are template parameters of Engine (below); these
+// are the defaults when a state or the command line does not give them
+static const int DEFAULT_BOARD_SIZE = 10;
+static const int DEFAULT_WIN_LENGTH = 5;
+static thread_local char myPlayer, oppPlayer;
 static const int INF = 1000000000;  // large value for win/loss
 // Heuristic weights for patterns
 static const int OPEN_FOUR   = 100000;
@@ -21,11 +46,483 @@ static const int CLOSED_THREE= 1000;
 static const int OPEN_TWO    = 500;
 static const int CLOSED_TWO  = 100;
 static const int ONE_PIECE   = 10;
+// Split patterns, scored on top of the runs they contain: X.XXX / XX.XX need
+// one stone to make five like a closed four, .X.XX. one to make an open four
+static const int BROKEN_FOUR  = CLOSED_FOUR;
+static const int BROKEN_THREE = OPEN_THREE;
+// Weights indexed by run length (1..4) for five in a row; see runWeight()
+static const int OPEN_WEIGHT[5]   = {0, ONE_PIECE, OPEN_TWO, OPEN_THREE, OPEN_FOUR};
+static const int CLOSED_WEIGHT[5] = {0, 1, CLOSED_TWO, CLOSED_THREE, CLOSED_FOUR};
 
-static std::chrono::steady_clock::time_point startTime;
+// Start of the current search. Per thread, like searchStop below, so that
+// independent searches (batch workers) can run side by side; Lazy SMP
+// helpers take both over from the thread that started the search.
+static thread_local std::chrono::steady_clock::time_point startTime;
 static std::chrono::milliseconds timeLimit(4800); // 4.8 seconds limit (safe margin)
+// Stands for "no time limit" while still comparing safely with clock durations
+static const std::chrono::milliseconds NO_TIME_LIMIT = std::chrono::hours(24 * 365);
+// Per-move time of book self-play when no limit is given: a hundred games at
+// the full 4.8 s would take over an hour
+static const std::chrono::milliseconds BOOK_MOVETIME(250);
+// Nodes each search thread may visit per move; 0 means no limit
+static long nodeLimit = 0;
+// Reading the clock costs more than a node, so it is only read once every
+// TIME_CHECK_INTERVAL nodes (a power of two); roughly a millisecond of search
+static const long TIME_CHECK_INTERVAL = 1024;
+// Deepest iteration of the main search
+static const int MAX_DEPTH = 15;
+static int depthLimit = MAX_DEPTH;
+// Write statistics for every move to stderr
+static bool statsEnabled = false;
+// Raised by the main search thread to stop Lazy SMP helpers, or by the
+// daemon to stop a ponder search
+static std::atomic<bool> stopSearch(false);
+// Stop flag of the search this thread takes part in; batch workers point it
+// at a flag of their own
+static thread_local std::atomic<bool>* searchStop = &stopSearch;
+static int numThreads = 1;
+// Positions searched at once in batch mode, each with numThreads threads
+static int batchWorkers = 1;
+// Set while a ponder search runs: only stopSearch ends it, not the clock
+static bool pondering = false;
+// Daemon option: keep searching on the opponent's time
+static bool ponderEnabled = false;
+// Search behind step 7 of choose_move(): alpha-beta, or MCTS with --engine mcts
+static bool mctsEnabled = false;
+// MCTS node arena per searching thread
+static const size_t DEFAULT_TREE_MB = 64;
+static size_t treeMb = DEFAULT_TREE_MB;
+// MCTS threads each grow a tree of their own instead of sharing one
+static bool mctsRootParallel = false;
 
-struct TimeOutException : public std::exception {};
+// ---------------------------------------------------------------------------
+// Bitboard representation
+//
+// Squares are numbered row-major with one extra, always-empty guard column per
+// row (sq = r * STRIDE + c). Shifting a mask by one of the four direction steps
+// moves every stone one cell along that direction; runs that would wrap onto
+// the next row fall into the guard column and break, so line detection needs
+// no per-row edge masks.
+// ---------------------------------------------------------------------------
+static const int ME = 0, OPP = 1;  // side indices into stones[]
+
+// A set of squares in WORDS 64-bit words; each engine variant uses the
+// smallest word count covering its board
+template<int WORDS>
+struct BitboardT {
+    uint64_t w[WORDS];
+
+    bool test(int sq) const { return (w[sq >> 6] >> (sq & 63)) & 1; }
+    void set(int sq) { w[sq >> 6] |= uint64_t(1) << (sq & 63); }
+    void clear(int sq) { w[sq >> 6] &= ~(uint64_t(1) << (sq & 63)); }
+    bool any() const {
+        uint64_t acc = 0;
+        for (int i = 0; i < WORDS; ++i) acc |= w[i];
+        return acc != 0;
+    }
+    int count() const {
+        int n = 0;
+        for (int i = 0; i < WORDS; ++i) n += __builtin_popcountll(w[i]);
+        return n;
+    }
+    // Index of the lowest set bit; the board must not be empty
+    int lowest() const {
+        for (int i = 0; i < WORDS; ++i) {
+            if (w[i]) return i * 64 + __builtin_ctzll(w[i]);
+        }
+        return -1;
+    }
+    // Remove and return the lowest set bit
+    int popLowest() {
+        for (int i = 0; i < WORDS; ++i) {
+            if (w[i]) {
+                int sq = i * 64 + __builtin_ctzll(w[i]);
+                w[i] &= w[i] - 1;
+                return sq;
+            }
+        }
+        return -1;
+    }
+};
+
+template<int WORDS>
+static inline BitboardT<WORDS> operator&(const BitboardT<WORDS>& a, const BitboardT<WORDS>& b) {
+    BitboardT<WORDS> r;
+    for (int i = 0; i < WORDS; ++i) r.w[i] = a.w[i] & b.w[i];
+    return r;
+}
+template<int WORDS>
+static inline BitboardT<WORDS> operator|(const BitboardT<WORDS>& a, const BitboardT<WORDS>& b) {
+    BitboardT<WORDS> r;
+    for (int i = 0; i < WORDS; ++i) r.w[i] = a.w[i] | b.w[i];
+    return r;
+}
+template<int WORDS>
+static inline BitboardT<WORDS> operator^(const BitboardT<WORDS>& a, const BitboardT<WORDS>& b) {
+    BitboardT<WORDS> r;
+    for (int i = 0; i < WORDS; ++i) r.w[i] = a.w[i] ^ b.w[i];
+    return r;
+}
+template<int WORDS>
+static inline BitboardT<WORDS> operator~(const BitboardT<WORDS>& a) {
+    BitboardT<WORDS> r;
+    for (int i = 0; i < WORDS; ++i) r.w[i] = ~a.w[i];
+    return r;
+}
+// Move every bit towards higher square indices (r << s)
+template<int WORDS>
+static inline BitboardT<WORDS> operator<<(const BitboardT<WORDS>& a, int s) {
+    BitboardT<WORDS> r;
+    int ws = s >> 6, bs = s & 63;
+    for (int i = WORDS - 1; i >= 0; --i) {
+        uint64_t v = 0;
+        if (i - ws >= 0) {
+            v = a.w[i - ws] << bs;
+            if (bs && i - ws - 1 >= 0) v |= a.w[i - ws - 1] >> (64 - bs);
+        }
+        r.w[i] = v;
+    }
+    return r;
+}
+// Move every bit towards lower square indices (r >> s)
+template<int WORDS>
+static inline BitboardT<WORDS> operator>>(const BitboardT<WORDS>& a, int s) {
+    BitboardT<WORDS> r;
+    int ws = s >> 6, bs = s & 63;
+    for (int i = 0; i < WORDS; ++i) {
+        uint64_t v = 0;
+        if (i + ws < WORDS) {
+            v = a.w[i + ws] >> bs;
+            if (bs && i + ws + 1 < WORDS) v |= a.w[i + ws + 1] << (64 - bs);
+        }
+        r.w[i] = v;
+    }
+    return r;
+}
+
+// ---------------------------------------------------------------------------
+// Transposition table
+//
+// A power-of-two array of 64-byte buckets holding four entries each. An entry
+// stores a packed word with the score, best move, search depth, bound type and
+// the search generation that wrote it, next to the 64-bit key XORed with that
+// word. The table is shared by all search threads without locks: a torn write
+// (key from one store, data from another) fails the XOR check and reads as a
+// miss.
+// ---------------------------------------------------------------------------
+enum Bound : uint8_t { BOUND_NONE = 0, BOUND_UPPER = 1, BOUND_LOWER = 2, BOUND_EXACT = 3 };
+static const int NO_MOVE = 0xFFFF;
+static const int TT_BUCKET_SIZE = 4;
+static const size_t DEFAULT_HASH_MB = 64;
+
+struct TTEntry {
+    std::atomic<uint64_t> check;  // key ^ data
+    std::atomic<uint64_t> data;   // score:32 | move:16 | depth:8 | bound:2 | generation:6
+};
+
+struct alignas(64) TTBucket {
+    TTEntry entries[TT_BUCKET_SIZE];
+};
+
+struct TTProbe {
+    int score;
+    int move;
+    int depth;
+    Bound bound;
+};
+
+static TTBucket* ttTable;
+static void* ttMemory;  // allocation holding ttTable, which is aligned within it
+static uint64_t ttMask;
+static std::atomic<uint8_t> ttGeneration;
+
+static inline uint64_t packTT(int score, int move, int depth, Bound bound, uint8_t gen) {
+    return uint64_t(uint32_t(score))
+         | (uint64_t(move & 0xFFFF) << 32)
+         | (uint64_t(depth & 0xFF) << 48)
+         | (uint64_t(bound & 0x3) << 56)
+         | (uint64_t(gen & 0x3F) << 58);
+}
+
+void ttClear() {
+    for (uint64_t i = 0; i <= ttMask; ++i) {
+        for (TTEntry& e : ttTable[i].entries) {
+            e.check.store(0, std::memory_order_relaxed);
+            e.data.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// Allocate the table with the largest power-of-two bucket count fitting `mb`.
+// calloc hands out large blocks as fresh zero pages, so the table starts
+// empty without writing it all up front; untouched pages cost nothing, which
+// matters when a process answers a single move.
+void ttResize(size_t mb) {
+    size_t buckets = 1;
+    while (buckets * 2 * sizeof(TTBucket) <= mb * 1024 * 1024) buckets *= 2;
+    std::free(ttMemory);
+    ttMemory = std::calloc(buckets * sizeof(TTBucket) + alignof(TTBucket), 1);
+    if (!ttMemory) throw std::bad_alloc();
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ttMemory);
+    addr = (addr + alignof(TTBucket) - 1) & ~uintptr_t(alignof(TTBucket) - 1);
+    ttTable = reinterpret_cast<TTBucket*>(addr);
+    ttMask = buckets - 1;
+}
+
+// Start a new search; entries from older searches become preferred victims
+void ttNewSearch() {
+    ttGeneration.store((ttGeneration.load(std::memory_order_relaxed) + 1) & 0x3F,
+                       std::memory_order_relaxed);
+}
+
+bool ttProbe(uint64_t key, TTProbe& out) {
+    const TTBucket& b = ttTable[key & ttMask];
+    for (const TTEntry& e : b.entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        uint64_t check = e.check.load(std::memory_order_relaxed);
+        if ((check ^ data) != key || !data) continue;
+        out.score = int32_t(uint32_t(data));
+        out.move = int((data >> 32) & 0xFFFF);
+        out.depth = int((data >> 48) & 0xFF);
+        out.bound = Bound((data >> 56) & 0x3);
+        return true;
+    }
+    return false;
+}
+
+void ttStore(uint64_t key, int score, int move, int depth, Bound bound) {
+    TTBucket& b = ttTable[key & ttMask];
+    uint8_t generation = ttGeneration.load(std::memory_order_relaxed);
+    TTEntry* victim = &b.entries[0];
+    int victimValue = INF;
+    for (TTEntry& e : b.entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        bool same = (e.check.load(std::memory_order_relaxed) ^ data) == key;
+        if (same || !data) {
+            // Keep the old best move if this search did not produce one
+            if (same && move == NO_MOVE && data) move = int((data >> 32) & 0xFFFF);
+            victim = &e;
+            break;
+        }
+        // Replace the shallowest entry, treating stale generations as shallower
+        int gen = int((data >> 58) & 0x3F);
+        int value = int((data >> 48) & 0xFF) - (gen == generation ? 0 : 64);
+        if (value < victimValue) {
+            victimValue = value;
+            victim = &e;
+        }
+    }
+    uint64_t data = packTT(score, move, depth, bound, generation);
+    victim->data.store(data, std::memory_order_relaxed);
+    victim->check.store(key ^ data, std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+// Opening book
+//
+// A book file is a header followed by entries sorted by key. The key is the
+// canonical (symmetry-reduced) hash of a position with the side to move's
+// stones first, and the move is stored in the orientation that gives the
+// canonical hash. A key may have several entries, heaviest first. The file
+// is memory-mapped read-only and searched by bisection, so opening it costs
+// nothing up front and every process on the machine shares the same pages.
+// ---------------------------------------------------------------------------
+static const char BOOK_MAGIC[8] = {'G', 'M', 'K', 'B', 'O', 'O', 'K', '1'};
+
+struct BookHeader {
+    char magic[8];
+    uint32_t boardSize;
+    uint32_t winLength;
+    uint64_t count;
+};
+
+struct BookEntry {
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+    uint32_t reserved;
+};
+
+static const BookHeader* bookHeader;
+static const BookEntry* bookEntries;
+
+// Map a book file. Returns false with a message in `error` if it cannot be
+// used.
+bool bookOpen(const char* path, std::string& error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error = std::string("cannot open book: ") + std::strerror(errno);
+        return false;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(BookHeader))
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        error = "book is empty or cannot be mapped";
+        return false;
+    }
+    const BookHeader* header = static_cast<const BookHeader*>(data);
+    if (std::memcmp(header->magic, BOOK_MAGIC, sizeof(BOOK_MAGIC)) != 0
+        || header->count != (st.st_size - sizeof(BookHeader)) / sizeof(BookEntry)) {
+        munmap(data, st.st_size);
+        error = "not a book file";
+        return false;
+    }
+    bookHeader = header;
+    bookEntries = reinterpret_cast<const BookEntry*>(header + 1);
+    return true;
+}
+
+// Heaviest book entry for `key`, or nullptr
+const BookEntry* bookFind(uint64_t key) {
+    if (!bookHeader) return nullptr;
+    const BookEntry* end = bookEntries + bookHeader->count;
+    const BookEntry* it = std::lower_bound(bookEntries, end, key,
+        [](const BookEntry& e, uint64_t k) { return e.key < k; });
+    return it != end && it->key == key ? it : nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// Result cache
+//
+// An optional file of search results (best move, score and depth) that
+// outlives the process and is shared by every bot process that opens it.
+// The file is a header followed by a fixed number of buckets, memory-mapped
+// read-write with MAP_SHARED. Entries work like the transposition table's:
+// two words written without locks, the key XORed into the check word, so a
+// torn entry reads as a miss. Keys are canonical position hashes and moves
+// are stored in the canonical orientation, so symmetric positions share an
+// entry. A full bucket gives up its shallowest entry, the least recently
+// written first among equals. Only the header is written under a lock, by
+// whichever process creates the file.
+// ---------------------------------------------------------------------------
+static const char CACHE_MAGIC[8] = {'G', 'M', 'K', 'C', 'A', 'C', 'H', '1'};
+static const size_t DEFAULT_CACHE_MB = 64;
+// Shallowest alpha-beta result served from the cache; about what a search
+// reaches in the default 4.8 s, so a quick run cannot answer for a full one
+static const int DEFAULT_CACHE_MIN_DEPTH = 7;
+static int cacheMinDepth = DEFAULT_CACHE_MIN_DEPTH;
+
+struct alignas(64) CacheHeader {
+    char magic[8];
+    uint32_t boardSize;
+    uint32_t winLength;
+    uint64_t buckets;  // a power of two
+};
+
+static TTBucket* cacheTable;
+static uint64_t cacheMask;
+
+// score:32 | move:16 | depth+1:8 | stamp:8; the depth is offset so that no
+// entry packs to zero, which marks an empty slot
+static inline uint64_t packCache(int score, int move, int depth, uint8_t stamp) {
+    return uint64_t(uint32_t(score))
+         | (uint64_t(move & 0xFFFF) << 32)
+         | (uint64_t((depth + 1) & 0xFF) << 48)
+         | (uint64_t(stamp) << 56);
+}
+
+// Coarse clock for the replacement policy, in hours and wrapping
+static inline uint8_t cacheStamp() {
+    return uint8_t(std::chrono::duration_cast<std::chrono::hours>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Open the cache at `path`, creating it with the largest power-of-two
+// bucket count fitting `mb` if it does not exist yet. An existing file keeps
+// its own size; it must be for the same board size and win length.
+bool cacheOpen(const char* path, size_t mb, int boardSize, int winLength, std::string& error) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error = std::string("cannot open cache: ") + std::strerror(errno);
+        return false;
+    }
+    flock(fd, LOCK_EX);
+    CacheHeader header = {};
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0) {
+        uint64_t buckets = 1;
+        while (buckets * 2 * sizeof(TTBucket) <= mb * 1024 * 1024) buckets *= 2;
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.boardSize = boardSize;
+        header.winLength = winLength;
+        header.buckets = buckets;
+        // The buckets start out as zero pages, i.e. empty entries
+        ok = ftruncate(fd, sizeof(CacheHeader) + buckets * sizeof(TTBucket)) == 0
+            && pwrite(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header));
+        st.st_size = sizeof(CacheHeader) + buckets * sizeof(TTBucket);
+        if (!ok) error = std::string("cannot create cache: ") + std::strerror(errno);
+    } else if (ok) {
+        ok = pread(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header))
+            && std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+            && header.buckets && (header.buckets & (header.buckets - 1)) == 0
+            && uint64_t(st.st_size) == sizeof(CacheHeader) + header.buckets * sizeof(TTBucket);
+        if (!ok) error = "not a cache file";
+        else if (header.boardSize != uint32_t(boardSize) || header.winLength != uint32_t(winLength)) {
+            error = "the cache is for " + std::to_string(header.boardSize) + "x" + std::to_string(header.boardSize)
+                + " with " + std::to_string(header.winLength) + " in a row";
+            ok = false;
+        }
+    }
+    void* data = ok ? mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (ok && data == MAP_FAILED) error = std::string("cannot map cache: ") + std::strerror(errno);
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    cacheTable = reinterpret_cast<TTBucket*>(static_cast<char*>(data) + sizeof(CacheHeader));
+    cacheMask = header.buckets - 1;
+    return true;
+}
+
+bool cacheProbe(uint64_t key, TTProbe& out) {
+    if (!cacheTable) return false;
+    const TTBucket& b = cacheTable[key & cacheMask];
+    for (const TTEntry& e : b.entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        uint64_t check = e.check.load(std::memory_order_relaxed);
+        if ((check ^ data) != key || !data) continue;
+        out.score = int32_t(uint32_t(data));
+        out.move = int((data >> 32) & 0xFFFF);
+        out.depth = int((data >> 48) & 0xFF) - 1;
+        out.bound = BOUND_EXACT;
+        return true;
+    }
+    return false;
+}
+
+void cacheStore(uint64_t key, int score, int move, int depth) {
+    if (!cacheTable) return;
+    TTBucket& b = cacheTable[key & cacheMask];
+    uint8_t stamp = cacheStamp();
+    TTEntry* victim = &b.entries[0];
+    int victimValue = INF;
+    for (TTEntry& e : b.entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        if (!data) {
+            victim = &e;
+            break;
+        }
+        if ((e.check.load(std::memory_order_relaxed) ^ data) == key) {
+            // Keep a deeper result for the same position
+            if (int((data >> 48) & 0xFF) - 1 > depth) return;
+            victim = &e;
+            break;
+        }
+        // Shallowest first, then the one written longest ago
+        int age = uint8_t(stamp - uint8_t(data >> 56));
+        int value = int((data >> 48) & 0xFF) * 256 - age;
+        if (value < victimValue) {
+            victimValue = value;
+            victim = &e;
+        }
+    }
+    uint64_t data = packCache(score, move, depth, stamp);
+    victim->data.store(data, std::memory_order_relaxed);
+    victim->check.store(key ^ data, std::memory_order_relaxed);
+}
 
 // Return list of empty positions on the board
 std::vector<std::pair<int,int>> get_valid_moves(const json& board) {
@@ -38,765 +535,2542 @@ std::vector<std::pair<int,int>> get_valid_moves(const json& board) {
             }
         }
     }
-    return moves;
-}
+    return moves;
+}
+
+// ---------------------------------------------------------------------------
+// Fast state.json reader
+//
+// States always have the same shape: {"board": [[cell, ...], ...], "player":
+// "X" or "O"} with cells "", "X" or "O". This reader walks the text once and
+// records the stones as one bit mask per row and symbol, without building a
+// JSON tree or allocating. On anything else (escapes, extra keys, ragged
+// rows, ...) it gives up and the caller falls back to nlohmann::json, which
+// also produces the error messages.
+// ---------------------------------------------------------------------------
+static const int MAX_BOARD_SIZE = 32;
+
+struct ParsedState {
+    int size;                          // rows, each with as many cells
+    char player;
+    uint32_t rows[2][MAX_BOARD_SIZE];  // [0] 'X', [1] 'O' stones; bit c = column c
+};
+
+static inline const char* skipSpace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+    return p;
+}
+
+// Read "", "X" or "O" at p; `symbol` is 0, 'X' or 'O'. Returns the position
+// after the string, or nullptr for anything else.
+static inline const char* readSymbol(const char* p, const char* end, char& symbol) {
+    if (end - p >= 2 && p[0] == '"' && p[1] == '"') {
+        symbol = 0;
+        return p + 2;
+    }
+    if (end - p >= 3 && p[0] == '"' && (p[1] == 'X' || p[1] == 'O') && p[2] == '"') {
+        symbol = p[1];
+        return p + 3;
+    }
+    return nullptr;
+}
+
+static inline const char* readKey(const char* p, const char* end, const char* key) {
+    size_t n = std::strlen(key);
+    if (size_t(end - p) < n + 2 || p[0] != '"' || std::memcmp(p + 1, key, n) != 0 || p[n + 1] != '"')
+        return nullptr;
+    p = skipSpace(p + n + 2, end);
+    return (p < end && *p == ':') ? skipSpace(p + 1, end) : nullptr;
+}
+
+static const char* readBoard(const char* p, const char* end, ParsedState& out) {
+    if (p == end || *p++ != '[') return nullptr;
+    int rows = 0;
+    p = skipSpace(p, end);
+    while (p < end && *p == '[') {
+        if (rows == MAX_BOARD_SIZE) return nullptr;
+        out.rows[0][rows] = out.rows[1][rows] = 0;
+        int cols = 0;
+        p = skipSpace(p + 1, end);
+        while (p < end && *p != ']') {
+            char symbol;
+            if (cols == MAX_BOARD_SIZE || !(p = readSymbol(p, end, symbol))) return nullptr;
+            if (symbol) out.rows[symbol == 'O'][rows] |= uint32_t(1) << cols;
+            cols++;
+            p = skipSpace(p, end);
+            if (p < end && *p == ',') {
+                p = skipSpace(p + 1, end);
+                if (p == end || *p == ']') return nullptr;  // trailing comma
+            } else if (p == end || *p != ']') {
+                return nullptr;
+            }
+        }
+        if (p == end || (rows > 0 && cols != out.size)) return nullptr;
+        out.size = cols;
+        rows++;
+        p = skipSpace(p + 1, end);
+        if (p < end && *p == ',') {
+            p = skipSpace(p + 1, end);
+            if (p == end || *p != '[') return nullptr;  // trailing comma
+        }
+    }
+    if (p == end || *p != ']' || rows == 0 || rows != out.size) return nullptr;
+    return p + 1;
+}
+
+// Parse a state from `len` bytes of text. Returns false if the text is not a
+// plain state, in which case `out` is unspecified.
+bool parseStateFast(const char* text, size_t len, ParsedState& out) {
+    const char* end = text + len;
+    const char* p = skipSpace(text, end);
+    bool haveBoard = false, havePlayer = false;
+    if (p == end || *p != '{') return false;
+    p = skipSpace(p + 1, end);
+    while (p < end && *p != '}') {
+        const char* value;
+        if (!haveBoard && (value = readKey(p, end, "board"))) {
+            p = readBoard(value, end, out);
+            haveBoard = true;
+        } else if (!havePlayer && (value = readKey(p, end, "player"))) {
+            char symbol = 0;
+            p = readSymbol(value, end, symbol);
+            if (!symbol) return false;  // also when p is null
+            out.player = symbol;
+            havePlayer = true;
+        } else {
+            return false;
+        }
+        if (!p) return false;
+        p = skipSpace(p, end);
+        if (p < end && *p == ',') {
+            p = skipSpace(p + 1, end);
+            if (p == end || *p == '}') return false;  // trailing comma
+        } else if (p == end || *p != '}') {
+            return false;
+        }
+    }
+    if (p == end) return false;
+    return haveBoard && havePlayer && skipSpace(p + 1, end) == end;
+}
+
+// ---------------------------------------------------------------------------
+// Engine
+//
+// Everything that depends on the board size or the win length lives in
+// Engine<BOARD_SIZE, WIN_LENGTH>, so each variant is compiled with both as
+// constants: tables are sized exactly and the loops over directions, line
+// windows and bitboard words unroll for that board. main() picks the
+// instantiation for the requested variant. "Five" in the names below means
+// WIN_LENGTH in a row.
+// ---------------------------------------------------------------------------
+template<int BOARD_SIZE, int WIN_LENGTH>
+struct Engine {
+    static_assert(BOARD_SIZE >= WIN_LENGTH, "the board must fit a winning line");
+    static_assert(BOARD_SIZE + WIN_LENGTH <= 32, "lines are kept in 32-bit masks and 64-bit codes");
+    static_assert(WIN_LENGTH >= 3, "patterns need at least three cells");
+    static constexpr int STRIDE = BOARD_SIZE + 1;
+    static constexpr int NUM_SQUARES = BOARD_SIZE * STRIDE;
+    static constexpr int BB_WORDS = (NUM_SQUARES + 63) / 64;
+    static_assert(NUM_SQUARES < 0xFFFF, "moves are stored in 16 bits");
+    using Bitboard = BitboardT<BB_WORDS>;
+    // Horizontal, vertical, diagonal (down-right) and anti-diagonal (down-left) steps
+    static constexpr int DIRS[4] = {1, STRIDE, STRIDE + 1, STRIDE - 1};
+
+    static inline Bitboard VALID_MASK;  // every real (non-guard) square
+    // Board state is per thread so Lazy SMP helpers can search their own copy
+    static inline thread_local Bitboard stones[2];  // stones[ME] = myPlayer, stones[OPP] = oppPlayer
+
+    static inline int squareOf(int r, int c) { return r * STRIDE + c; }
+
+    // -----------------------------------------------------------------------
+    // Incremental evaluation
+    //
+    // Every row, column and diagonal is a "line" with its own cached score. Placing
+    // or removing a stone only touches the four lines through that square, so the
+    // running total in evalScore is always the sum of all line contributions.
+    // -----------------------------------------------------------------------
+    static constexpr int NUM_LINES = 6 * BOARD_SIZE - 2;
+    static inline int lineOf[NUM_SQUARES][4];     // line through a square in each direction
+    static inline int linePos[NUM_SQUARES][4];    // index of the square within that line
+    static inline int lineLength[NUM_LINES];
+
+    // Pattern lookup: a line is also kept as a packed code with two bits per
+    // cell (EMPTY / ME+1 / OPP+1 / WALL), slot 0 being a wall before the first
+    // cell and walls padding the end. The score of a line is the sum, over its
+    // cells q, of the table entry for the window of WIN_LENGTH+1 cells starting
+    // at cell q-1; each entry scores only the patterns that begin at cell q, so
+    // nothing is counted twice. The table is built once at startup.
+    static constexpr int CELL_EMPTY = 0;
+    static constexpr int WINDOW_CELLS = WIN_LENGTH + 1;
+    static constexpr int WINDOW_MASK = (1 << (2 * WINDOW_CELLS)) - 1;
+    struct PatternEntry {
+        int32_t score;  // from ME's perspective
+        uint8_t five;   // bit `side` set if side has five starting here
+    };
+    static inline PatternEntry patternTable[1 << (2 * WINDOW_CELLS)];
+    static inline uint64_t emptyLineCode[NUM_LINES];
+
+    static inline thread_local uint32_t lineBits[NUM_LINES][2];  // stones of each side, bit i = i-th cell
+    static inline thread_local uint64_t lineCode[NUM_LINES];     // packed cells, see above
+    static inline thread_local int lineScore[NUM_LINES];         // contribution from ME's perspective
+    static inline thread_local uint8_t lineFive[NUM_LINES];      // bit `side` set if side has five here
+    static inline thread_local int evalScore;                    // sum of lineScore[]
+    static inline thread_local int fiveCount[2];                 // number of lines holding five per side
+
+    // Line contributions overwritten by a placement, restored on removal
+    struct UndoInfo {
+        int score[4];
+        uint8_t five[4];
+    };
+    static inline thread_local UndoInfo undoStack[BOARD_SIZE * BOARD_SIZE];
+    static inline thread_local int undoTop;
+
+    // Candidate squares: nearCount[sq] is the number of stones within two cells
+    // (Chebyshev distance) of sq, and nearMask has a bit for every square whose
+    // count is non-zero. Both are updated on placement/removal.
+    static constexpr int NEAR_RADIUS = 2;
+    static constexpr int MAX_NEIGHBOURS = (2 * NEAR_RADIUS + 1) * (2 * NEAR_RADIUS + 1) - 1;
+    static inline int neighbours[NUM_SQUARES][MAX_NEIGHBOURS];
+    static inline int neighbourCount[NUM_SQUARES];
+    static inline thread_local uint8_t nearCount[NUM_SQUARES];
+    static inline thread_local Bitboard nearMask;
+
+    // Zobrist hashing: one random key per (side, square), XORed in and out as
+    // stones are placed and removed. ZOBRIST_OPP_TO_MOVE is mixed in by the
+    // search when the opponent is the side to move.
+    static inline uint64_t zobrist[2][NUM_SQUARES];
+    static inline uint64_t ZOBRIST_OPP_TO_MOVE;
+    static inline thread_local uint64_t hashKey;
+
+    // The eight symmetries of the board, rotations and reflections: symmetry
+    // t takes square sq to symmetry[t][sq], and inverseSymmetry[t] undoes
+    // it. Bit 0 of t transposes, bit 1 flips the rows and bit 2 the columns.
+    //
+    // symmetricKey[t] is the hash of the board's image under symmetry t
+    // (symmetricKey[0] == hashKey), kept up to date by placeStone/removeStone
+    // from symmetricZobrist, which holds the eight keys of each (side,
+    // square) side by side. The smallest of the eight is the canonical key,
+    // the same for every symmetric image of a position; caches that outlive
+    // a search (the opening book, the result cache) are keyed by it, with
+    // moves stored in the orientation that gives it.
+    static constexpr int NUM_SYMMETRIES = 8;
+    static inline int symmetry[NUM_SYMMETRIES][NUM_SQUARES];
+    static inline int inverseSymmetry[NUM_SYMMETRIES];
+    alignas(64) static inline uint64_t symmetricZobrist[2][NUM_SQUARES][NUM_SYMMETRIES];
+    static inline thread_local uint64_t symmetricKey[NUM_SYMMETRIES];
+
+    // Squares on the four lines through a square, at most WIN_LENGTH-1 cells away
+    static inline Bitboard lineNeighbourhood[NUM_SQUARES];
+
+    static uint64_t splitmix64(uint64_t& state) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Weight of a run of `len` stones. The weight tables are for five in a row;
+    // for other win lengths a run is weighted by how many stones it is short.
+    static int runWeight(int len, bool open) {
+        int k = std::max(1, std::min(4, len + 5 - WIN_LENGTH));
+        return open ? OPEN_WEIGHT[k] : CLOSED_WEIGHT[k];
+    }
+
+    // Score the patterns beginning at cell 1 of a window (cell 0 is the one
+    // before it): runs with their open ends, plus split fours and threes
+    static PatternEntry scoreWindow(const int cell[WINDOW_CELLS]) {
+        PatternEntry e = {0, 0};
+        for (int side = 0; side < 2; ++side) {
+            int own = side + 1;
+            if (cell[1] != own) continue;
+            int sign = (side == ME ? 1 : -1);
+            auto empty = [&](int i) { return cell[i] == CELL_EMPTY; };
+            if (cell[0] != own) {
+                // Run starting here, as in the original run scanner
+                int len = 1;
+                while (len < WIN_LENGTH && cell[1 + len] == own) len++;
+                if (len >= WIN_LENGTH) {
+                    e.five |= uint8_t(1 << side);
+                } else {
+                    bool leftOpen = empty(0), rightOpen = empty(1 + len);
+                    if (leftOpen || rightOpen) e.score += sign * runWeight(len, leftOpen && rightOpen);
+                }
+            }
+            // A four with one inner gap in the WIN_LENGTH cells starting here
+            int stones = 0, gaps = 0;
+            for (int i = 1; i <= WIN_LENGTH; ++i) {
+                if (cell[i] == own) stones++;
+                else if (empty(i)) gaps++;
+            }
+            if (cell[WIN_LENGTH] == own && stones == WIN_LENGTH - 1 && gaps == 1) {
+                e.score += sign * BROKEN_FOUR;
+            }
+            // Open split three, one stone short of that with both ends open:
+            // .X.XX. or .XX.X. for five in a row
+            int inner = 0, innerGaps = 0;
+            for (int i = 1; i < WIN_LENGTH; ++i) {
+                if (cell[i] == own) inner++;
+                else if (empty(i)) innerGaps++;
+            }
+            if (empty(0) && empty(WIN_LENGTH) && cell[WIN_LENGTH - 1] == own
+                && inner == WIN_LENGTH - 2 && innerGaps == 1) {
+                e.score += sign * BROKEN_THREE;
+            }
+        }
+        return e;
+    }
+
+    static void initPatternTable() {
+        int cell[WINDOW_CELLS];
+        for (int code = 0; code <= WINDOW_MASK; ++code) {
+            for (int i = 0; i < WINDOW_CELLS; ++i) cell[i] = (code >> (2 * i)) & 3;
+            patternTable[code] = scoreWindow(cell);
+        }
+    }
+
+    static void initTables() {
+        VALID_MASK = Bitboard{};
+        for (int r = 0; r < BOARD_SIZE; ++r)
+            for (int c = 0; c < BOARD_SIZE; ++c)
+                VALID_MASK.set(squareOf(r, c));
+
+        const int steps[4][2] = {{0,1},{1,0},{1,1},{1,-1}};
+        int numLines = 0;
+        for (int d = 0; d < 4; ++d) {
+            int dr = steps[d][0], dc = steps[d][1];
+            for (int r = 0; r < BOARD_SIZE; ++r) {
+                for (int c = 0; c < BOARD_SIZE; ++c) {
+                    int pr = r - dr, pc = c - dc;
+                    if (pr >= 0 && pr < BOARD_SIZE && pc >= 0 && pc < BOARD_SIZE) continue;
+                    // (r,c) is the first cell of a line in direction d
+                    int len = 0;
+                    for (int rr = r, cc = c; rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE;
+                         rr += dr, cc += dc) {
+                        lineOf[squareOf(rr, cc)][d] = numLines;
+                        linePos[squareOf(rr, cc)][d] = len++;
+                    }
+                    // Walls everywhere except the line's own cells (slots 1..len)
+                    emptyLineCode[numLines] = ~uint64_t(0) & ~(((uint64_t(1) << (2 * len)) - 1) << 2);
+                    lineLength[numLines++] = len;
+                }
+            }
+        }
+
+        for (int r = 0; r < BOARD_SIZE; ++r) {
+            for (int c = 0; c < BOARD_SIZE; ++c) {
+                int sq = squareOf(r, c);
+                neighbourCount[sq] = 0;
+                for (int dr = -NEAR_RADIUS; dr <= NEAR_RADIUS; ++dr) {
+                    for (int dc = -NEAR_RADIUS; dc <= NEAR_RADIUS; ++dc) {
+                        if (dr == 0 && dc == 0) continue;
+                        int rr = r + dr, cc = c + dc;
+                        if (rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE)
+                            neighbours[sq][neighbourCount[sq]++] = squareOf(rr, cc);
+                    }
+                }
+            }
+        }
+
+        for (int r = 0; r < BOARD_SIZE; ++r) {
+            for (int c = 0; c < BOARD_SIZE; ++c) {
+                Bitboard& m = lineNeighbourhood[squareOf(r, c)];
+                m = Bitboard{};
+                for (auto& st : steps) {
+                    for (int k = -(WIN_LENGTH - 1); k <= WIN_LENGTH - 1; ++k) {
+                        int rr = r + k * st[0], cc = c + k * st[1];
+                        if (k != 0 && rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE)
+                            m.set(squareOf(rr, cc));
+                    }
+                }
+            }
+        }
+
+        uint64_t seed = 0x2545F4914F6CDD1DULL;  // fixed so hashes are reproducible
+        for (int side = 0; side < 2; ++side)
+            for (int sq = 0; sq < NUM_SQUARES; ++sq)
+                zobrist[side][sq] = splitmix64(seed);
+        ZOBRIST_OPP_TO_MOVE = splitmix64(seed);
+
+        for (int t = 0; t < NUM_SYMMETRIES; ++t) {
+            for (int sq = 0; sq < NUM_SQUARES; ++sq) symmetry[t][sq] = sq;  // guard squares stay put
+            for (int r = 0; r < BOARD_SIZE; ++r) {
+                for (int c = 0; c < BOARD_SIZE; ++c) {
+                    int a = (t & 1) ? c : r, b = (t & 1) ? r : c;
+                    if (t & 2) a = BOARD_SIZE - 1 - a;
+                    if (t & 4) b = BOARD_SIZE - 1 - b;
+                    symmetry[t][squareOf(r, c)] = squareOf(a, b);
+                }
+            }
+        }
+        for (int t = 0; t < NUM_SYMMETRIES; ++t) {
+            for (int u = 0; u < NUM_SYMMETRIES; ++u) {
+                bool inverse = true;
+                for (int sq = 0; sq < NUM_SQUARES; ++sq) inverse &= symmetry[u][symmetry[t][sq]] == sq;
+                if (inverse) inverseSymmetry[t] = u;
+            }
+        }
+        for (int side = 0; side < 2; ++side)
+            for (int sq = 0; sq < NUM_SQUARES; ++sq)
+                for (int t = 0; t < NUM_SYMMETRIES; ++t)
+                    symmetricZobrist[side][sq][t] = zobrist[side][symmetry[t][sq]];
+
+        initPatternTable();
+    }
+
+    // Clear the board and all incrementally maintained state
+    static void resetBoard() {
+        stones[ME] = stones[OPP] = Bitboard{};
+        for (int l = 0; l < NUM_LINES; ++l) {
+            lineBits[l][ME] = lineBits[l][OPP] = 0;
+            lineCode[l] = emptyLineCode[l];
+            lineScore[l] = 0;
+            lineFive[l] = 0;
+        }
+        evalScore = 0;
+        fiveCount[ME] = fiveCount[OPP] = 0;
+        undoTop = 0;
+        hashKey = 0;
+        std::fill(symmetricKey, symmetricKey + NUM_SYMMETRIES, 0);
+        std::fill(nearCount, nearCount + NUM_SQUARES, 0);
+        nearMask = Bitboard{};
+    }
+
+    // Score a packed line code by summing the window entries of its cells
+    static inline void scoreLineCode(uint64_t code, int length, int& score, uint8_t& five) {
+        score = 0;
+        five = 0;
+        for (int q = 0; q < length; ++q) {
+            const PatternEntry& e = patternTable[(code >> (2 * q)) & WINDOW_MASK];
+            score += e.score;
+            five |= e.five;
+        }
+    }
+
+    // Code change for `side` occupying cell `pos` of a line
+    static inline uint64_t cellCode(int pos, int side) {
+        return uint64_t(side + 1) << (2 * (pos + 1));
+    }
+
+    static inline void scoreLine(int line, int& score, uint8_t& five) {
+        scoreLineCode(lineCode[line], lineLength[line], score, five);
+    }
+
+    // Change in evaluation if `side` played at `sq`, computed from the four lines
+    // through the square without touching the board. Sets `five` if the move
+    // completes five in a row.
+    static inline int moveDelta(int sq, int side, bool& five) {
+        int delta = 0;
+        five = false;
+        for (int d = 0; d < 4; ++d) {
+            int l = lineOf[sq][d];
+            int score;
+            uint8_t lineFives;
+            scoreLineCode(lineCode[l] + cellCode(linePos[sq][d], side), lineLength[l], score, lineFives);
+            delta += score - lineScore[l];
+            if ((lineFives >> side) & 1) five = true;
+        }
+        return delta;
+    }
+
+    // Positions on a line where `att` would complete five: windows of five cells
+    // holding four of its stones and one empty cell
+    static inline uint32_t lineFiveGaps(uint32_t att, uint32_t def, int length) {
+        uint32_t empty = ((uint32_t(1) << length) - 1) & ~(att | def);
+        uint32_t gaps = 0;
+        for (int k = 0; k < WIN_LENGTH; ++k) {
+            uint32_t t = empty >> k;
+            for (int j = 0; j < WIN_LENGTH; ++j) {
+                if (j != k) t &= att >> j;
+            }
+            gaps |= t << k;
+        }
+        return gaps;
+    }
+
+    // Would `side` playing at `sq` create a four (a square completing five)?
+    static inline bool makesFour(int sq, int side) {
+        for (int d = 0; d < 4; ++d) {
+            int l = lineOf[sq][d];
+            uint32_t att = lineBits[l][side] | (uint32_t(1) << linePos[sq][d]);
+            if (lineFiveGaps(att, lineBits[l][1 - side], lineLength[l])) return true;
+        }
+        return false;
+    }
+
+    // Would `side` playing at `sq` create a three, i.e. a line on which one more
+    // stone makes an open four (two distinct squares completing five)?
+    static inline bool makesThree(int sq, int side) {
+        for (int d = 0; d < 4; ++d) {
+            int l = lineOf[sq][d];
+            int len = lineLength[l];
+            uint32_t att = lineBits[l][side] | (uint32_t(1) << linePos[sq][d]);
+            uint32_t def = lineBits[l][1 - side];
+            uint32_t empty = ((uint32_t(1) << len) - 1) & ~(att | def);
+            while (empty) {
+                int e = __builtin_ctz(empty);
+                empty &= empty - 1;
+                if (__builtin_popcount(lineFiveGaps(att | (uint32_t(1) << e), def, len)) >= 2) return true;
+            }
+        }
+        return false;
+    }
+
+    static inline void placeStone(int sq, int side) {
+        stones[side].set(sq);
+        hashKey ^= zobrist[side][sq];
+        for (int t = 0; t < NUM_SYMMETRIES; ++t) symmetricKey[t] ^= symmetricZobrist[side][sq][t];
+        for (int i = 0; i < neighbourCount[sq]; ++i) {
+            int n = neighbours[sq][i];
+            if (nearCount[n]++ == 0) nearMask.set(n);
+        }
+        UndoInfo& u = undoStack[undoTop++];
+        for (int d = 0; d < 4; ++d) {
+            int l = lineOf[sq][d];
+            u.score[d] = lineScore[l];
+            u.five[d] = lineFive[l];
+            lineBits[l][side] |= uint32_t(1) << linePos[sq][d];
+            lineCode[l] += cellCode(linePos[sq][d], side);
+            int score;
+            uint8_t five;
+            scoreLine(l, score, five);
+            evalScore += score - lineScore[l];
+            fiveCount[ME] += ((five >> ME) & 1) - ((lineFive[l] >> ME) & 1);
+            fiveCount[OPP] += ((five >> OPP) & 1) - ((lineFive[l] >> OPP) & 1);
+            lineScore[l] = score;
+            lineFive[l] = five;
+        }
+    }
+
+    // Undo the most recent placeStone(); removals must mirror placements in LIFO order
+    static inline void removeStone(int sq, int side) {
+        stones[side].clear(sq);
+        hashKey ^= zobrist[side][sq];
+        for (int t = 0; t < NUM_SYMMETRIES; ++t) symmetricKey[t] ^= symmetricZobrist[side][sq][t];
+        for (int i = 0; i < neighbourCount[sq]; ++i) {
+            int n = neighbours[sq][i];
+            if (--nearCount[n] == 0) nearMask.clear(n);
+        }
+        const UndoInfo& u = undoStack[--undoTop];
+        for (int d = 0; d < 4; ++d) {
+            int l = lineOf[sq][d];
+            lineBits[l][side] &= ~(uint32_t(1) << linePos[sq][d]);
+            lineCode[l] -= cellCode(linePos[sq][d], side);
+            evalScore += u.score[d] - lineScore[l];
+            fiveCount[ME] += ((u.five[d] >> ME) & 1) - ((lineFive[l] >> ME) & 1);
+            fiveCount[OPP] += ((u.five[d] >> OPP) & 1) - ((lineFive[l] >> OPP) & 1);
+            lineScore[l] = u.score[d];
+            lineFive[l] = u.five[d];
+        }
+    }
+
+    // Reset the board and place the given stones of both sides
+    static void loadPosition(const Bitboard position[2]) {
+        resetBoard();
+        for (int side = 0; side < 2; ++side) {
+            Bitboard b = position[side];
+            while (b.any()) placeStone(b.popLowest(), side);
+        }
+    }
+
+    static inline Bitboard occupied() { return stones[ME] | stones[OPP]; }
+    static inline Bitboard emptySquares() { return VALID_MASK & ~occupied(); }
+
+    // Bits p such that p, p+d, ..., p+(WIN_LENGTH-1)d all belong to `m`
+    static inline Bitboard fiveStarts(const Bitboard& m, int d) {
+        // Double the run length while it fits, then overlap two runs
+        Bitboard t = m;
+        int run = 1;
+        for (; 2 * run <= WIN_LENGTH; run *= 2) t = t & (t >> (run * d));
+        if (run < WIN_LENGTH) t = t & (t >> ((WIN_LENGTH - run) * d));
+        return t;
+    }
+
+    // Check if the stone of `side` at `sq` is part of five in a row (win condition)
+    static bool checkFiveInRow(int sq, int side) {
+        const Bitboard& m = stones[side];
+        for (int d : DIRS) {
+            Bitboard t = fiveStarts(m, d);
+            if (!t.any()) continue;
+            for (int k = 0; k < WIN_LENGTH; ++k) {
+                int start = sq - k * d;
+                if (start >= 0 && t.test(start)) return true;
+            }
+        }
+        return false;
+    }
+
+    // Empty squares where `side` would complete five in a row
+    static Bitboard winningSquares(int side) {
+        const Bitboard& m = stones[side];
+        Bitboard empty = emptySquares();
+        Bitboard result{};
+        for (int d : DIRS) {
+            Bitboard shifted[WIN_LENGTH];
+            Bitboard shiftedEmpty[WIN_LENGTH];
+            for (int k = 0; k < WIN_LENGTH; ++k) {
+                shifted[k] = m >> (k * d);
+                shiftedEmpty[k] = empty >> (k * d);
+            }
+            // Window starting at p with the gap at offset k
+            for (int k = 0; k < WIN_LENGTH; ++k) {
+                Bitboard t = shiftedEmpty[k];
+                for (int j = 0; j < WIN_LENGTH; ++j) {
+                    if (j != k) t = t & shifted[j];
+                }
+                result = result | (t << (k * d));
+            }
+        }
+        return result & empty;
+    }
+
+    // Candidate moves: empty squares within two cells of an existing piece,
+    // the center on an empty board, or every empty square as a last resort
+    static Bitboard generateCandidates() {
+        Bitboard occ = occupied();
+        if (!occ.any()) {
+            Bitboard center{};
+            center.set(squareOf(BOARD_SIZE / 2, BOARD_SIZE / 2));
+            return center;
+        }
+        Bitboard empty = VALID_MASK & ~occ;
+        Bitboard cand = nearMask & empty;
+        if (!cand.any()) cand = empty;
+        return cand;
+    }
+
+    // Static evaluation of the current board from the perspective of `myPlayer`.
+    // The line contributions are maintained by placeStone/removeStone, so this is
+    // just a read of the running totals.
+    static int evaluateBoard() {
+        if (fiveCount[ME]) return INF;
+        if (fiveCount[OPP]) return -INF;
+        return evalScore;
+    }
+
+    // Candidate moves with their ordering scores, scored once per node
+    static constexpr int MAX_MOVES = BOARD_SIZE * BOARD_SIZE;
+    struct MoveList {
+        int count;
+        int moves[MAX_MOVES];
+        int scores[MAX_MOVES];
+    };
+
+    // Killer moves (two per ply) and history scores, both fed by beta cutoffs.
+    // Killers are reset for every search; history is halved instead, so in daemon
+    // mode it keeps carrying over between moves of the same game.
+    static constexpr int MAX_PLY = 64;
+    static constexpr int HISTORY_MAX = 1 << 20;
+    // Moves whose static gain reaches this are tactical (they make or stop at
+    // least a three) and keep their static order; killers and history only
+    // reorder the quiet moves below it
+    static constexpr int QUIET_LIMIT = OPEN_THREE / 2;
+    static inline thread_local int killers[MAX_PLY][2];
+    // Counters of this thread's current search
+    struct SearchStats {
+        long nodes;         // minimax nodes visited
+        long leafEvals;     // static evaluations at depth 0
+        long ttProbes;
+        long ttHits;
+        long expanded;      // nodes whose moves were searched
+        long cutoffs;       // ... that ended in a beta cutoff
+        long firstCutoffs;  // ... on the first move tried
+    };
+    static inline thread_local SearchStats stats;
+    // Counters of the last parallelSearch() over all its threads
+    static inline thread_local SearchStats searchTotals;
+
+    // Iterations completed by this thread in the current search
+    struct IterationInfo {
+        int depth;
+        int score;
+        long nodes;  // this thread's nodes so far
+        double ms;   // time since the search started
+    };
+    static inline thread_local IterationInfo iterations[MAX_DEPTH];
+    static inline thread_local int iterationCount;
+
+    // Raised once the current search has to stop (stop flag, clock or node
+    // limit). Every frame then undoes its move and returns without storing
+    // anything, so the board is back at the root when the search returns.
+    static inline thread_local bool searchAborted;
+
+    static inline bool checkAbort() {
+        if (!searchAborted
+            && (searchStop->load(std::memory_order_relaxed)
+                || (!pondering && ((nodeLimit && stats.nodes > nodeLimit)
+                                   || ((stats.nodes & (TIME_CHECK_INTERVAL - 1)) == 0
+                                       && std::chrono::steady_clock::now() - startTime >= timeLimit))))) {
+            searchAborted = true;
+        }
+        return searchAborted;
+    }
+    static inline thread_local int history[2][NUM_SQUARES];
+
+    static inline void clearKillers() {
+        for (int ply = 0; ply < MAX_PLY; ++ply) killers[ply][0] = killers[ply][1] = NO_MOVE;
+    }
+
+    static inline void clearHistory() {
+        std::memset(history, 0, sizeof(history));
+    }
+
+    static inline void ageHistory() {
+        for (int side = 0; side < 2; ++side)
+            for (int sq = 0; sq < NUM_SQUARES; ++sq) history[side][sq] /= 2;
+    }
+
+    // Remember a move that caused a beta cutoff at `ply`
+    static inline void recordCutoff(int side, int move, int depth, int ply) {
+        if (killers[ply][0] != move) {
+            killers[ply][1] = killers[ply][0];
+            killers[ply][0] = move;
+        }
+        history[side][move] += depth * depth;
+        if (history[side][move] > HISTORY_MAX) ageHistory();
+    }
+
+    // Fill `list` with the candidates for `side`, scored by how much they improve
+    // the evaluation for the mover. Winning moves come first, then `hintMove`,
+    // then tactical moves; quiet moves are ranked killers first, then by static
+    // gain plus history.
+    static inline void generateMoves(MoveList& list, int side, int hintMove, int ply) {
+        list.count = 0;
+        Bitboard cand = generateCandidates();
+        while (cand.any()) {
+            int sq = cand.popLowest();
+            bool five;
+            int delta = moveDelta(sq, side, five);
+            int score = (side == ME ? delta : -delta);
+            if (five) score = INF;
+            else if (sq == hintMove) score = INF - 1;
+            else if (score < QUIET_LIMIT) {
+                if (sq == killers[ply][0]) score = QUIET_LIMIT - 1;
+                else if (sq == killers[ply][1]) score = QUIET_LIMIT - 2;
+                else score = std::min(score + history[side][sq], QUIET_LIMIT - 3);
+            }
+            list.moves[list.count] = sq;
+            list.scores[list.count] = score;
+            list.count++;
+        }
+    }
+
+    // Selection step: swap the best remaining move into slot i and return it
+    static inline int pickNext(MoveList& list, int i) {
+        int best = i;
+        for (int j = i + 1; j < list.count; ++j) {
+            if (list.scores[j] > list.scores[best]) best = j;
+        }
+        std::swap(list.moves[i], list.moves[best]);
+        std::swap(list.scores[i], list.scores[best]);
+        return list.moves[i];
+    }
+
+    // Record a search result with the bound implied by the original window
+    static inline void storeResult(uint64_t key, int score, int move, int depth, int alpha, int beta) {
+        Bound bound = score <= alpha ? BOUND_UPPER : score >= beta ? BOUND_LOWER : BOUND_EXACT;
+        ttStore(key, score, move, depth, bound);
+    }
+
+    // Aspiration window half-width around the previous iteration's score, and the
+    // width beyond which a failing side is opened up completely
+    static constexpr int ASPIRATION_WINDOW = 1000;
+    static constexpr int ASPIRATION_MAX = 100000;
+
+    // Minimax search with alpha-beta pruning. Returns best score for current player.
+    static int searchMinimax(int depth, int ply, bool maximizingPlayer, int alpha, int beta) {
+        ++stats.nodes;
+        if (checkAbort()) return 0;
+        if (depth == 0) {
+            stats.leafEvals++;
+            return evaluateBoard();
+        }
+        uint64_t key = hashKey ^ (maximizingPlayer ? 0 : ZOBRIST_OPP_TO_MOVE);
+        int ttMove = NO_MOVE;
+        TTProbe probe;
+        stats.ttProbes++;
+        if (ttProbe(key, probe)) {
+            stats.ttHits++;
+            if (probe.depth >= depth) {
+                if (probe.bound == BOUND_EXACT) return probe.score;
+                if (probe.bound == BOUND_LOWER && probe.score >= beta) return probe.score;
+                if (probe.bound == BOUND_UPPER && probe.score <= alpha) return probe.score;
+            }
+            ttMove = probe.move;
+        }
+        const int alphaOrig = alpha, betaOrig = beta;
+        int bestMove = NO_MOVE;
+        MoveList moves;
+        if (maximizingPlayer) {
+            int bestVal = -INF;
+            // Move ordering: best heuristic value for us first
+            generateMoves(moves, ME, ttMove, ply);
+            if (moves.count) stats.expanded++;
+            for (int i = 0; i < moves.count; ++i) {
+                int mv = pickNext(moves, i);
+                placeStone(mv, ME);
+                int moveScore;
+                if (checkFiveInRow(mv, ME)) {
+                    // immediate win achieved
+                    moveScore = INF;
+                } else if (i == 0) {
+                    moveScore = searchMinimax(depth - 1, ply + 1, false, alpha, beta);
+                } else {
+                    // PVS: prove the move is no better than alpha with a null
+                    // window, re-searching only if it turns out to be
+                    moveScore = searchMinimax(depth - 1, ply + 1, false, alpha, alpha + 1);
+                    if (moveScore > alpha && moveScore < beta) {
+                        moveScore = searchMinimax(depth - 1, ply + 1, false, alpha, beta);
+                    }
+                }
+                removeStone(mv, ME);
+                if (searchAborted) return 0;
+                if (moveScore > bestVal) {
+                    bestVal = moveScore;
+                    bestMove = mv;
+                }
+                if (moveScore > alpha) {
+                    alpha = moveScore;
+                }
+                if (alpha >= beta) {
+                    // beta cut-off
+                    recordCutoff(ME, mv, depth, ply);
+                    stats.cutoffs++;
+                    if (i == 0) stats.firstCutoffs++;
+                    break;
+                }
+                if (bestVal == INF) {
+                    // found a winning move, no need to search further at this depth
+                    break;
+                }
+            }
+            storeResult(key, bestVal, bestMove, depth, alphaOrig, betaOrig);
+            return bestVal;
+        } else {  // minimizing player (opponent's turn)
+            int bestVal = INF;
+            // Order moves by the opponent's gain (lowest resulting score for us first)
+            generateMoves(moves, OPP, ttMove, ply);
+            if (moves.count) stats.expanded++;
+            for (int i = 0; i < moves.count; ++i) {
+                int mv = pickNext(moves, i);
+                placeStone(mv, OPP);
+                int moveScore;
+                if (checkFiveInRow(mv, OPP)) {
+                    moveScore = -INF;
+                } else if (i == 0) {
+                    moveScore = searchMinimax(depth - 1, ply + 1, true, alpha, beta);
+                } else {
+                    moveScore = searchMinimax(depth - 1, ply + 1, true, beta - 1, beta);
+                    if (moveScore < beta && moveScore > alpha) {
+                        moveScore = searchMinimax(depth - 1, ply + 1, true, alpha, beta);
+                    }
+                }
+                removeStone(mv, OPP);
+                if (searchAborted) return 0;
+                if (moveScore < bestVal) {
+                    bestVal = moveScore;
+                    bestMove = mv;
+                }
+                if (moveScore < beta) {
+                    beta = moveScore;
+                }
+                if (alpha >= beta) {
+                    recordCutoff(OPP, mv, depth, ply);
+                    stats.cutoffs++;
+                    if (i == 0) stats.firstCutoffs++;
+                    break;
+                }
+                if (bestVal == -INF) {
+                    break;
+                }
+            }
+            storeResult(key, bestVal, bestMove, depth, alphaOrig, betaOrig);
+            return bestVal;
+        }
+    }
+
+    // -----------------------------------------------------------------------
+    // Threat-space search
+    //
+    // Looks for forced wins made only of forcing moves: victory by continuous
+    // fours (VCF), and victory by continuous threats (VCT) which also allows
+    // threes. The defender answers a four with its single block, and a three
+    // with any empty square on the threatened lines or a counter-four. Both
+    // searches are bounded by a node budget so the result is reproducible.
+    //
+    // Every position the solver proves is remembered with its winning move
+    // until a later search fails to find one, so once a win is proven the
+    // rest of the sequence is played from memory as long as the defender
+    // keeps to the replies it covered, however big the proof was.
+    // -----------------------------------------------------------------------
+    static constexpr int VCF_MAX_DEPTH = 15;      // attacker moves
+    static constexpr int VCT_MAX_DEPTH = 5;
+    static constexpr long VCF_NODE_LIMIT = 20000;
+    static constexpr long VCT_NODE_LIMIT = 20000;
+    static inline thread_local long threatNodes;
+    static inline thread_local long threatNodeLimit;
+    static inline thread_local std::unordered_map<uint64_t, uint16_t> threatProof;  // position -> winning move
+
+    static void recordThreatWin(int att, int sq) {
+        threatProof[hashKey ^ (att == ME ? 0 : ZOBRIST_OPP_TO_MOVE)] = uint16_t(sq);
+    }
+
+    // The attacker just made a four: the defender must block it
+    static bool defendFour(int att, int depth, bool allowThrees) {
+        Bitboard wins = winningSquares(att);
+        if (wins.count() >= 2) return true;  // open four or double four
+        int block = wins.lowest();
+        placeStone(block, 1 - att);
+        bool win = threatSearch(att, depth - 1, allowThrees, nullptr);
+        removeStone(block, 1 - att);
+        return win;
+    }
+
+    // The attacker just made a three at `sq`: every defence must lose
+    static bool defendThree(int att, int sq, int depth) {
+        int def = 1 - att;
+        Bitboard empty = emptySquares();
+        Bitboard replies = lineNeighbourhood[sq] & empty;
+        Bitboard counters = nearMask & empty & ~replies;
+        while (counters.any()) {
+            int c = counters.popLowest();
+            if (makesFour(c, def)) replies.set(c);
+        }
+        while (replies.any()) {
+            int r = replies.popLowest();
+            placeStone(r, def);
+            bool win = threatSearch(att, depth - 1, true, nullptr);
+            removeStone(r, def);
+            if (!win) return false;
+        }
+        return true;
+    }
+
+    // `att` to move: can it force five using only fours (and threes if allowed)?
+    // On success the first move of the sequence is stored in *firstMove.
+    static bool threatSearch(int att, int depth, bool allowThrees, int* firstMove) {
+        if (++threatNodes > threatNodeLimit) return false;
+        int def = 1 - att;
+        Bitboard wins = winningSquares(att);
+        if (wins.any()) {
+            if (firstMove) *firstMove = wins.lowest();
+            recordThreatWin(att, wins.lowest());
+            return true;
+        }
+        Bitboard defWins = winningSquares(def);
+        int defWinCount = defWins.count();
+        if (defWinCount >= 2 || depth == 0) return false;
+        // Facing a four, the only legal try is the block, and it must keep the
+        // initiative by being a four itself
+        Bitboard cand = defWinCount ? defWins : (nearMask & emptySquares());
+        int passes = (allowThrees && !defWinCount) ? 2 : 1;
+        for (int pass = 0; pass < passes; ++pass) {
+            Bitboard b = cand;
+            while (b.any()) {
+                int sq = b.popLowest();
+                bool four = makesFour(sq, att);
+                if (pass == 0 ? !four : (four || !makesThree(sq, att))) continue;
+                placeStone(sq, att);
+                bool win = four ? defendFour(att, depth, allowThrees) : defendThree(att, sq, depth);
+                removeStone(sq, att);
+                if (win) {
+                    if (firstMove) *firstMove = sq;
+                    recordThreatWin(att, sq);
+                    return true;
+                }
+                if (threatNodes > threatNodeLimit) return false;
+            }
+        }
+        return false;
+    }
+
+    // Next move of a forced win for ME proven earlier, else the first move of
+    // one found by VCF, then VCT, or -1
+    static int findThreatWin() {
+        auto proven = threatProof.find(hashKey);
+        if (proven != threatProof.end() && emptySquares().test(proven->second)) {
+            threatNodes = 0;
+            return proven->second;
+        }
+        threatProof.clear();
+        int move = -1;
+        threatNodes = 0;
+        threatNodeLimit = VCF_NODE_LIMIT;
+        if (threatSearch(ME, VCF_MAX_DEPTH, false, &move)) return move;
+        threatNodes = 0;
+        threatNodeLimit = VCT_NODE_LIMIT;
+        if (threatSearch(ME, VCT_MAX_DEPTH, true, &move)) return move;
+        return -1;
+    }
+
+    // Search every root move at `depth` within (alpha, beta) using PVS. Returns
+    // the best score and sets bestMoveOut to the move that achieved it.
+    static int searchRoot(int depth, int alpha, int beta, int hintMove, int& bestMoveOut) {
+        int bestScore = -INF;
+        bestMoveOut = -1;
+        // Generate moves (same approach as in searchMinimax for maximizing root),
+        // with the hinted move (previous iteration's best) first
+        MoveList moves;
+        generateMoves(moves, ME, hintMove, 0);
+        for (int i = 0; i < moves.count; ++i) {
+            int mv = pickNext(moves, i);
+            placeStone(mv, ME);
+            int score;
+            if (checkFiveInRow(mv, ME)) {
+                score = INF;
+            } else if (i == 0) {
+                score = searchMinimax(depth - 1, 1, false, alpha, beta);
+            } else {
+                score = searchMinimax(depth - 1, 1, false, alpha, alpha + 1);
+                if (score > alpha && score < beta) {
+                    score = searchMinimax(depth - 1, 1, false, alpha, beta);
+                }
+            }
+            removeStone(mv, ME);
+            if (searchAborted) break;
+            if (score > bestScore) {
+                bestScore = score;
+                bestMoveOut = mv;
+            }
+            if (score > alpha) alpha = score;
+            if (alpha >= beta || bestScore == INF) {
+                // cut off further moves at this depth
+                break;
+            }
+        }
+        return bestScore;
+    }
+
+    // Iterative deepening from the current position. Returns the best move of
+    // the deepest completed iteration, or -1 if none completed in time. Helper
+    // threads (odd ids) start one ply deeper so that the threads spread over
+    // neighbouring depths and share their results through the table.
+    //
+    // Each iteration after the first searches an aspiration window around the
+    // previous score; a fail-low or fail-high widens that side of the window
+    // (by a growing margin, eventually to infinity) and searches again.
+    static int iterativeDeepening(int threadId) {
+        int bestMove = -1;
+        int prevScore = 0;
+        int maxDepthReached = 0;
+        clearKillers();
+        ageHistory();
+        stats = SearchStats{};
+        iterationCount = 0;
+        searchAborted = false;
+        for (int depth = 1 + (threadId & 1); depth <= depthLimit; ++depth) {
+            int alpha = -INF, beta = INF;
+            int window = ASPIRATION_WINDOW;
+            if (maxDepthReached > 0 && prevScore > -INF && prevScore < INF) {
+                alpha = std::max(-INF, prevScore - window);
+                beta = std::min(INF, prevScore + window);
+            }
+            int hint = bestMove;
+            int bestScore, bestMoveThisDepth;
+            for (;;) {
+                bestScore = searchRoot(depth, alpha, beta, hint, bestMoveThisDepth);
+                if (searchAborted) break;
+                window *= 4;
+                if (bestScore <= alpha && alpha > -INF) {
+                    alpha = window > ASPIRATION_MAX ? -INF : std::max(-INF, bestScore - window);
+                } else if (bestScore >= beta && beta < INF) {
+                    beta = window > ASPIRATION_MAX ? INF : std::min(INF, bestScore + window);
+                    hint = bestMoveThisDepth;
+                } else {
+                    break;
+                }
+            }
+            // Stopped mid-iteration; use bestMove from last completed depth
+            if (searchAborted) break;
+            // If we complete the depth search successfully, store the result
+            bestMove = bestMoveThisDepth;
+            prevScore = bestScore;
+            maxDepthReached = depth;
+            ttStore(hashKey, bestScore, bestMove, depth, BOUND_EXACT);
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - startTime;
+            iterations[iterationCount++] = {depth, bestScore, stats.nodes, ms.count()};
+            // If a winning move is found, we can break early
+            if (bestScore == INF) break;
+        }
+        return bestMove;
+    }
+
+    // Iterative deepening on the current position with Lazy SMP helpers filling
+    // the shared transposition table in parallel. The caller clears its stop
+    // flag before starting; it is raised here once the calling thread is done.
+    static int parallelSearch() {
+        ttNewSearch();
+        std::vector<std::thread> helpers;
+        Bitboard rootPosition[2] = {stones[ME], stones[OPP]};
+        std::atomic<bool>* stop = searchStop;
+        auto start = startTime;
+        std::vector<SearchStats> helperStats(numThreads);
+        for (int id = 1; id < numThreads; ++id) {
+            helpers.emplace_back([id, rootPosition, stop, start, &helperStats]() {
+                searchStop = stop;
+                startTime = start;
+                loadPosition(rootPosition);
+                iterativeDeepening(id);
+                helperStats[id] = stats;
+            });
+        }
+        int bestMove = iterativeDeepening(0);
+        *stop = true;
+        for (std::thread& t : helpers) t.join();
+        helperStats[0] = stats;
+        searchTotals = SearchStats{};
+        for (const SearchStats& h : helperStats) {
+            searchTotals.nodes += h.nodes;
+            searchTotals.leafEvals += h.leafEvals;
+            searchTotals.ttProbes += h.ttProbes;
+            searchTotals.ttHits += h.ttHits;
+            searchTotals.expanded += h.expanded;
+            searchTotals.cutoffs += h.cutoffs;
+            searchTotals.firstCutoffs += h.firstCutoffs;
+        }
+        return bestMove;
+    }
+
+    // -----------------------------------------------------------------------
+    // Monte Carlo tree search (--engine mcts)
+    //
+    // Replaces the alpha-beta search in step 7 of choose_move(). A playout
+    // walks down the tree by PUCT, expands the leaf it reaches once that leaf
+    // has been visited before, and ends with a short rollout in which each
+    // side completes a five if it can, blocks one if it must, and otherwise
+    // plays a candidate picked at random in proportion to its pattern gain
+    // (moveDelta). A rollout still open after MCTS_ROLLOUT_PLIES moves is
+    // scored by the static evaluation. The same gains, normalised, are the
+    // priors of a node's children, of which only the best MCTS_MAX_CHILDREN
+    // are kept.
+    //
+    // Nodes live in one arena per tree, allocated on first use and never
+    // freed; the children of a node are one contiguous block. When the next
+    // position follows from the root by our move and the opponent's reply
+    // (daemon mode), that subtree is kept: it is compacted to the front of
+    // the arena and everything else is dropped.
+    //
+    // With several threads, all of them run playouts on the calling thread's
+    // tree without locks. Visits and values are atomic counters, a node is
+    // expanded by whichever thread claims it first, and a visit is counted on
+    // the way down, before its result is added on the way up: until then it
+    // reads as a loss (virtual loss), which steers the other threads to other
+    // lines. With --mcts-parallel root each thread grows a tree of its own
+    // instead and the root visits are summed over the trees at the end. The
+    // trees belong to the thread that starts the search, indexed by search
+    // thread id, so every one of them is kept and reused like the first.
+    // -----------------------------------------------------------------------
+    static constexpr uint8_t MCTS_LEAF = 0, MCTS_EXPANDING = 1, MCTS_EXPANDED = 2, MCTS_WON = 3;
+    struct MctsNode {
+        std::atomic<uint64_t> value;   // summed results for the side that played `move`, in MCTS_VALUE_ONE units
+        std::atomic<uint32_t> visits;  // including playouts still under way
+        uint32_t firstChild;           // arena index of the first child, once expanded
+        float prior;
+        uint16_t move;
+        uint8_t childCount;
+        std::atomic<uint8_t> state;    // MCTS_LEAF ... MCTS_EXPANDED, or MCTS_WON if `move` completes five
+    };
+    struct MctsTree {
+        std::unique_ptr<MctsNode[]> nodes;
+        uint32_t capacity;
+        std::atomic<uint32_t> used;    // 0: no tree yet; may overshoot capacity
+        Bitboard rootPosition[2];
+        char rootPlayer;
+        uint32_t reused;               // root visits kept from the last search
+    };
+    static constexpr int MCTS_MAX_CHILDREN = 32;
+    static constexpr uint32_t MCTS_EXPAND_VISITS = 1;
+    static constexpr int MCTS_ROLLOUT_PLIES = 16;
+    static constexpr int MCTS_GAIN_BASE = CLOSED_TWO;        // added to every gain
+    static constexpr float MCTS_EVAL_SCALE = OPEN_THREE;     // evaluation per logit
+    static constexpr float MCTS_C_PUCT = 1.5f;
+    static constexpr uint64_t MCTS_VALUE_ONE = 1 << 16;
+    static inline thread_local std::deque<MctsTree> mctsTrees;  // of searches started on this thread, by thread id
+    static inline thread_local MctsTree* mcts;               // tree this thread searches
+    static inline thread_local MctsNode* mctsTree;           // mcts->nodes
+    static inline thread_local uint64_t mctsRng;
+    static inline thread_local long mctsPlayouts;            // this thread's, in the current search
+    static inline thread_local long mctsTotalPlayouts;       // of the last mctsSearch() over all threads
+
+    static void mctsUse(MctsTree& tree) {
+        if (!tree.nodes) {
+            tree.capacity = uint32_t(std::min<size_t>(treeMb * 1024 * 1024 / sizeof(MctsNode), UINT32_MAX / 2));
+            tree.nodes.reset(new MctsNode[tree.capacity]);
+        }
+        mcts = &tree;
+        mctsTree = tree.nodes.get();
+    }
+
+    static void mctsInit(MctsNode& n, uint16_t move, float prior, uint8_t state) {
+        n.value.store(0, std::memory_order_relaxed);
+        n.visits.store(0, std::memory_order_relaxed);
+        n.firstChild = 0;
+        n.prior = prior;
+        n.move = move;
+        n.childCount = 0;
+        n.state.store(state, std::memory_order_relaxed);
+    }
+
+    static float mctsMean(const MctsNode& n, float unvisited) {
+        uint32_t visits = n.visits.load(std::memory_order_relaxed);
+        if (!visits) return unvisited;
+        return float(n.value.load(std::memory_order_relaxed)) / (float(MCTS_VALUE_ONE) * visits);
+    }
+
+    // Moves for `side` with their weights: the winning square if there is one
+    // (returns true), else the squares blocking the opponent's five, else all
+    // candidates weighted by gain for the mover. Empty only on a full board.
+    static bool mctsMoves(MoveList& list, int side) {
+        list.count = 0;
+        Bitboard cand = winningSquares(side);
+        if (cand.any()) {
+            list.moves[0] = cand.lowest();
+            list.scores[0] = 1;
+            list.count = 1;
+            return true;
+        }
+        Bitboard blocks = winningSquares(1 - side);
+        cand = blocks.any() ? blocks : generateCandidates();
+        while (cand.any()) {
+            int sq = cand.popLowest();
+            bool five;
+            int delta = moveDelta(sq, side, five);
+            int gain = side == ME ? delta : -delta;
+            list.moves[list.count] = sq;
+            list.scores[list.count] = std::max(gain, 0) + MCTS_GAIN_BASE;
+            list.count++;
+        }
+        return false;
+    }
+
+    // Play out the position with `side` to move. Sets `result` for ME (1 win,
+    // 0 loss) and returns false if the search was stopped meanwhile.
+    static bool mctsRollout(int side, float& result) {
+        int moves[MCTS_ROLLOUT_PLIES];
+        int placed = 0;
+        int mover = side;
+        bool stopped = false;
+        result = -1.0f;
+        MoveList list;
+        while (placed < MCTS_ROLLOUT_PLIES) {
+            if (mctsMoves(list, mover)) {
+                result = mover == ME ? 1.0f : 0.0f;
+                break;
+            }
+            if (!list.count) {
+                result = 0.5f;
+                break;
+            }
+            long total = 0;
+            for (int i = 0; i < list.count; ++i) total += list.scores[i];
+            long pick = long(splitmix64(mctsRng) % uint64_t(total));
+            int i = 0;
+            while ((pick -= list.scores[i]) >= 0) ++i;
+            placeStone(list.moves[i], mover);
+            moves[placed++] = list.moves[i];
+            mover = 1 - mover;
+            ++stats.nodes;
+            if (checkAbort()) {
+                stopped = true;
+                break;
+            }
+        }
+        if (result < 0) result = 1.0f / (1.0f + std::exp(-evaluateBoard() / MCTS_EVAL_SCALE));
+        for (int i = placed - 1; i >= 0; --i) removeStone(moves[i], (i & 1) ? 1 - side : side);
+        return !stopped;
+    }
 
-// Check if placing `symbol` at (r,c) yields five in a row (win condition)
-bool checkFiveInRow(int r, int c, char symbol) {
-    int directions[4][2] = {{0,1},{1,0},{1,1},{1,-1}};
-    for (auto& d : directions) {
-        int dr = d[0], dc = d[1];
-        int count = 1;
-        // check backward
-        int rr = r - dr, cc = c - dc;
-        while (rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE 
-               && boardArr[rr][cc] == symbol) {
-            count++;
-            rr -= dr; cc -= dc;
-        }
-        // check forward
-        rr = r + dr; cc = c + dc;
-        while (rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE 
-               && boardArr[rr][cc] == symbol) {
-            count++;
-            rr += dr; cc += dc;
-        }
-        if (count >= 5) return true;
+    // Give `node` (with `side` to move, claimed by this thread) its children,
+    // best prior first. Returns its new state: still a leaf if there is
+    // nothing to play or another thread filled the arena first.
+    static uint8_t mctsExpand(uint32_t node, int side) {
+        MoveList list;
+        bool winning = mctsMoves(list, side);
+        int count = std::min(list.count, MCTS_MAX_CHILDREN);
+        uint32_t first = 0;
+        if (count && mcts->used.load(std::memory_order_relaxed) + count <= mcts->capacity) {
+            first = mcts->used.fetch_add(count, std::memory_order_relaxed);
+            if (first + count > mcts->capacity) first = 0;
+        }
+        uint8_t state = first ? MCTS_EXPANDED : MCTS_LEAF;
+        if (first) {
+            long total = 0;
+            for (int i = 0; i < count; ++i) {
+                pickNext(list, i);
+                total += list.scores[i];
+            }
+            for (int i = 0; i < count; ++i) {
+                mctsInit(mctsTree[first + i], uint16_t(list.moves[i]), float(list.scores[i]) / total,
+                         winning ? MCTS_WON : MCTS_LEAF);
+            }
+            mctsTree[node].firstChild = first;
+            mctsTree[node].childCount = count;
+        }
+        mctsTree[node].state.store(state, std::memory_order_release);
+        return state;
     }
-    return false;
-}
 
-// Static evaluation of the current board from the perspective of `myPlayer`
-int evaluateBoard() {
-    int score = 0;
-    // Check all lines (horizontal, vertical, diagonals) for patterns
-    // Horizontal lines
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        int j = 0;
-        while (j < BOARD_SIZE) {
-            if (boardArr[i][j] != '.') {
-                char sym = boardArr[i][j];
-                // start of a contiguous sequence of sym
-                if (j == 0 || boardArr[i][j-1] != sym) {
-                    int k = j;
-                    while (k < BOARD_SIZE && boardArr[i][k] == sym) {
-                        k++;
-                    }
-                    int length = k - j;
-                    bool leftOpen = (j-1 >= 0 && boardArr[i][j-1] == '.');
-                    bool rightOpen = (k < BOARD_SIZE && boardArr[i][k] == '.');
-                    if (length >= 5) {
-                        // Already a five-in-a-row on board
-                        return (sym == myPlayer ? INF : -INF);
-                    }
-                    if (leftOpen || rightOpen) {  // at least one end is open
-                        if (sym == myPlayer) {
-                            if (leftOpen && rightOpen) {  // open sequence
-                                switch(length) {
-                                    case 4: score += OPEN_FOUR; break;
-                                    case 3: score += OPEN_THREE; break;
-                                    case 2: score += OPEN_TWO; break;
-                                    case 1: score += ONE_PIECE; break;
-                                }
-                            } else {  // closed sequence (one end blocked)
-                                switch(length) {
-                                    case 4: score += CLOSED_FOUR; break;
-                                    case 3: score += CLOSED_THREE; break;
-                                    case 2: score += CLOSED_TWO; break;
-                                    case 1: score += 1; break;
-                                }
-                            }
-                        } else {  // opponent's sequence
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score -= OPEN_FOUR; break;
-                                    case 3: score -= OPEN_THREE; break;
-                                    case 2: score -= OPEN_TWO; break;
-                                    case 1: score -= ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score -= CLOSED_FOUR; break;
-                                    case 3: score -= CLOSED_THREE; break;
-                                    case 2: score -= CLOSED_TWO; break;
-                                    case 1: score -= 1; break;
-                                }
-                            }
-                        }
-                    }
-                    j = k;
-                    continue;
-                }
+    // PUCT: the child maximising its mean result plus a prior-weighted bonus
+    // that shrinks with its visits. Unvisited children count at the parent's
+    // mean.
+    static uint32_t mctsSelect(const MctsNode& node) {
+        float parentMean = 1.0f - mctsMean(node, 0.5f);
+        float scale = MCTS_C_PUCT * std::sqrt(float(node.visits.load(std::memory_order_relaxed) + 1));
+        uint32_t best = node.firstChild;
+        float bestScore = -1.0f;
+        for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+            const MctsNode& child = mctsTree[c];
+            uint32_t visits = child.visits.load(std::memory_order_relaxed);
+            float score = mctsMean(child, parentMean) + scale * child.prior / (1 + visits);
+            if (score > bestScore) {
+                bestScore = score;
+                best = c;
             }
-            j++;
         }
+        return best;
     }
-    // Vertical lines
-    for (int j = 0; j < BOARD_SIZE; j++) {
-        int i = 0;
-        while (i < BOARD_SIZE) {
-            if (boardArr[i][j] != '.') {
-                char sym = boardArr[i][j];
-                if (i == 0 || boardArr[i-1][j] != sym) {
-                    int k = i;
-                    while (k < BOARD_SIZE && boardArr[k][j] == sym) {
-                        k++;
-                    }
-                    int length = k - i;
-                    bool leftOpen = (i-1 >= 0 && boardArr[i-1][j] == '.');
-                    bool rightOpen = (k < BOARD_SIZE && boardArr[k][j] == '.');
-                    if (length >= 5) {
-                        return (sym == myPlayer ? INF : -INF);
-                    }
-                    if (leftOpen || rightOpen) {
-                        if (sym == myPlayer) {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score += OPEN_FOUR; break;
-                                    case 3: score += OPEN_THREE; break;
-                                    case 2: score += OPEN_TWO; break;
-                                    case 1: score += ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score += CLOSED_FOUR; break;
-                                    case 3: score += CLOSED_THREE; break;
-                                    case 2: score += CLOSED_TWO; break;
-                                    case 1: score += 1; break;
-                                }
-                            }
-                        } else {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score -= OPEN_FOUR; break;
-                                    case 3: score -= OPEN_THREE; break;
-                                    case 2: score -= OPEN_TWO; break;
-                                    case 1: score -= ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score -= CLOSED_FOUR; break;
-                                    case 3: score -= CLOSED_THREE; break;
-                                    case 2: score -= CLOSED_TWO; break;
-                                    case 1: score -= 1; break;
-                                }
-                            }
-                        }
-                    }
-                    i = k;
-                    continue;
-                }
+
+    // One playout from the root. Returns false, taking its visits back, if
+    // the search was stopped meanwhile.
+    static bool mctsPlayout() {
+        uint32_t path[MAX_MOVES + 1];
+        int moves[MAX_MOVES];
+        int length = 0;
+        uint32_t node = 0;
+        int side = ME;  // to move at `node`
+        float result = 0.5f;  // for ME
+        bool stopped = false;
+        path[length++] = 0;
+        mctsTree[0].visits.fetch_add(1, std::memory_order_relaxed);
+        for (;;) {
+            MctsNode& n = mctsTree[node];
+            uint8_t state = n.state.load(std::memory_order_acquire);
+            if (state == MCTS_WON) {
+                result = side == ME ? 0.0f : 1.0f;
+                break;
             }
-            i++;
-        }
-    }
-    // Diagonal (down-right) lines
-    for (int startRow = 0; startRow < BOARD_SIZE; startRow++) {
-        // diagonals starting at each cell of first column and first row
-        int i = startRow, j = 0;
-        // (Also handle separately starting from first row below)
-        while (i < BOARD_SIZE && j < BOARD_SIZE) {
-            if (boardArr[i][j] != '.') {
-                char sym = boardArr[i][j];
-                if (i == startRow || j == 0 || boardArr[i-1][j-1] != sym) {
-                    int ii = i, jj = j;
-                    while (ii < BOARD_SIZE && jj < BOARD_SIZE && boardArr[ii][jj] == sym) {
-                        ii++; jj++;
-                    }
-                    int length = ii - i;
-                    bool leftOpen = (i-1 >= 0 && j-1 >= 0 && boardArr[i-1][j-1] == '.');
-                    bool rightOpen = (ii < BOARD_SIZE && jj < BOARD_SIZE && boardArr[ii][jj] == '.');
-                    if (length >= 5) {
-                        return (sym == myPlayer ? INF : -INF);
-                    }
-                    if (leftOpen || rightOpen) {
-                        if (sym == myPlayer) {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score += OPEN_FOUR; break;
-                                    case 3: score += OPEN_THREE; break;
-                                    case 2: score += OPEN_TWO; break;
-                                    case 1: score += ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score += CLOSED_FOUR; break;
-                                    case 3: score += CLOSED_THREE; break;
-                                    case 2: score += CLOSED_TWO; break;
-                                    case 1: score += 1; break;
-                                }
-                            }
-                        } else {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score -= OPEN_FOUR; break;
-                                    case 3: score -= OPEN_THREE; break;
-                                    case 2: score -= OPEN_TWO; break;
-                                    case 1: score -= ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score -= CLOSED_FOUR; break;
-                                    case 3: score -= CLOSED_THREE; break;
-                                    case 2: score -= CLOSED_TWO; break;
-                                    case 1: score -= 1; break;
-                                }
-                            }
-                        }
-                    }
-                    i = ii; j = jj;
-                    continue;
-                }
+            // Only claim a leaf while the arena has room for a full child
+            // block; otherwise every visit would redo the move generation
+            // just to throw it away
+            if (state == MCTS_LEAF
+                && (node == 0 || n.visits.load(std::memory_order_relaxed) > MCTS_EXPAND_VISITS)
+                && mcts->used.load(std::memory_order_relaxed) + MCTS_MAX_CHILDREN <= mcts->capacity
+                && n.state.compare_exchange_strong(state, MCTS_EXPANDING, std::memory_order_acquire)) {
+                state = mctsExpand(node, side);
+            }
+            if (state != MCTS_EXPANDED) {
+                stopped = !mctsRollout(side, result);
+                break;
+            }
+            node = mctsSelect(n);
+            mctsTree[node].visits.fetch_add(1, std::memory_order_relaxed);
+            placeStone(mctsTree[node].move, side);
+            moves[length - 1] = mctsTree[node].move;
+            path[length++] = node;
+            side = 1 - side;
+            ++stats.nodes;
+            if (checkAbort()) {
+                stopped = true;
+                break;
             }
-            i++; j++;
         }
+        // path[i] was entered by ME for odd i and by OPP for even i
+        uint64_t mine = uint64_t(result * MCTS_VALUE_ONE + 0.5f);
+        for (int i = length - 1; i >= 0; --i) {
+            if (stopped) mctsTree[path[i]].visits.fetch_sub(1, std::memory_order_relaxed);
+            else mctsTree[path[i]].value.fetch_add((i & 1) ? mine : MCTS_VALUE_ONE - mine, std::memory_order_relaxed);
+            if (i > 0) removeStone(moves[i - 1], (i & 1) ? ME : OPP);
+        }
+        return !stopped;
     }
-    for (int startCol = 1; startCol < BOARD_SIZE; ++startCol) {
-        // diagonals starting at each cell of first row (except [0,0] which was covered)
-        int i = 0, j = startCol;
-        while (i < BOARD_SIZE && j < BOARD_SIZE) {
-            if (boardArr[i][j] != '.') {
-                char sym = boardArr[i][j];
-                if (i == 0 || j == startCol || boardArr[i-1][j-1] != sym) {
-                    int ii = i, jj = j;
-                    while (ii < BOARD_SIZE && jj < BOARD_SIZE && boardArr[ii][jj] == sym) {
-                        ii++; jj++;
-                    }
-                    int length = ii - i;
-                    bool leftOpen = (i-1 >= 0 && j-1 >= 0 && boardArr[i-1][j-1] == '.');
-                    bool rightOpen = (ii < BOARD_SIZE && jj < BOARD_SIZE && boardArr[ii][jj] == '.');
-                    if (length >= 5) {
-                        return (sym == myPlayer ? INF : -INF);
-                    }
-                    if (leftOpen || rightOpen) {
-                        if (sym == myPlayer) {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score += OPEN_FOUR; break;
-                                    case 3: score += OPEN_THREE; break;
-                                    case 2: score += OPEN_TWO; break;
-                                    case 1: score += ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score += CLOSED_FOUR; break;
-                                    case 3: score += CLOSED_THREE; break;
-                                    case 2: score += CLOSED_TWO; break;
-                                    case 1: score += 1; break;
-                                }
-                            }
-                        } else {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score -= OPEN_FOUR; break;
-                                    case 3: score -= OPEN_THREE; break;
-                                    case 2: score -= OPEN_TWO; break;
-                                    case 1: score -= ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score -= CLOSED_FOUR; break;
-                                    case 3: score -= CLOSED_THREE; break;
-                                    case 2: score -= CLOSED_TWO; break;
-                                    case 1: score -= 1; break;
-                                }
-                            }
-                        }
-                    }
-                    i = ii; j = jj;
-                    continue;
-                }
+
+    // Child of `node` reached by `move`, or 0
+    static uint32_t mctsChild(uint32_t node, int move) {
+        const MctsNode& n = mctsTree[node];
+        if (n.state.load(std::memory_order_acquire) != MCTS_EXPANDED) return 0;
+        for (uint32_t c = n.firstChild; c < n.firstChild + n.childCount; ++c) {
+            if (mctsTree[c].move == move) return c;
+        }
+        return 0;
+    }
+
+    static void mctsCopy(MctsNode& to, const MctsNode& from) {
+        to.value.store(from.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.visits.store(from.visits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.firstChild = from.firstChild;
+        to.prior = from.prior;
+        to.move = from.move;
+        to.childCount = from.childCount;
+        to.state.store(from.state.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    // Make `root` the root and drop everything outside its subtree. The child
+    // blocks that stay are packed after index 0 in their arena order, so each
+    // moves down, never over a block that has yet to move. Only called while
+    // no other thread is searching the tree.
+    static void mctsReroot(uint32_t root) {
+        std::vector<std::pair<uint32_t, uint32_t>> blocks;  // old first child, count
+        std::vector<uint32_t> pending = {root};
+        while (!pending.empty()) {
+            const MctsNode& n = mctsTree[pending.back()];
+            pending.pop_back();
+            if (n.state.load(std::memory_order_relaxed) != MCTS_EXPANDED) continue;
+            blocks.push_back({n.firstChild, n.childCount});
+            for (uint32_t c = n.firstChild; c < n.firstChild + n.childCount; ++c) pending.push_back(c);
+        }
+        std::sort(blocks.begin(), blocks.end());
+        std::vector<uint32_t> newFirst(blocks.size());
+        uint32_t used = 1;
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            newFirst[b] = used;
+            used += blocks[b].second;
+        }
+        auto relocate = [&](MctsNode& n) {
+            if (n.state.load(std::memory_order_relaxed) != MCTS_EXPANDED) return;
+            auto it = std::lower_bound(blocks.begin(), blocks.end(), std::make_pair(n.firstChild, uint32_t(0)));
+            n.firstChild = newFirst[it - blocks.begin()];
+        };
+        relocate(mctsTree[root]);
+        for (const auto& block : blocks) {
+            for (uint32_t c = block.first; c < block.first + block.second; ++c) relocate(mctsTree[c]);
+        }
+        MctsNode top;
+        mctsCopy(top, mctsTree[root]);
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            for (uint32_t i = 0; i < blocks[b].second; ++i) mctsCopy(mctsTree[newFirst[b] + i], mctsTree[blocks[b].first + i]);
+        }
+        mctsCopy(mctsTree[0], top);
+        mcts->used.store(used, std::memory_order_relaxed);
+    }
+
+    // Point this thread's tree at the current position, keeping the old tree
+    // if the position is its root or follows from it by one move of each side
+    static void mctsSetRoot() {
+        int keep = -1;
+        if (mcts->used.load(std::memory_order_relaxed) && myPlayer == mcts->rootPlayer
+            && !(mcts->rootPosition[ME] & ~stones[ME]).any()
+            && !(mcts->rootPosition[OPP] & ~stones[OPP]).any()) {
+            Bitboard mine = stones[ME] & ~mcts->rootPosition[ME];
+            Bitboard theirs = stones[OPP] & ~mcts->rootPosition[OPP];
+            if (!mine.any() && !theirs.any()) {
+                keep = 0;
+            } else if (mine.count() == 1 && theirs.count() == 1) {
+                uint32_t reply = mctsChild(0, mine.lowest());
+                if (reply) reply = mctsChild(reply, theirs.lowest());
+                if (reply) keep = reply;
             }
-            i++; j++;
         }
+        if (keep > 0) {
+            mctsReroot(keep);
+        } else if (keep < 0) {
+            mctsInit(mctsTree[0], NO_MOVE, 1.0f, MCTS_LEAF);
+            mcts->used.store(1, std::memory_order_relaxed);
+        }
+        mcts->rootPosition[ME] = stones[ME];
+        mcts->rootPosition[OPP] = stones[OPP];
+        mcts->rootPlayer = myPlayer;
+        mcts->reused = mctsTree[0].visits.load(std::memory_order_relaxed);
     }
-    // Anti-diagonal (down-left) lines
-    for (int startRow = 0; startRow < BOARD_SIZE; ++startRow) {
-        int i = startRow, j = BOARD_SIZE - 1;
-        while (i < BOARD_SIZE && j >= 0) {
-            if (boardArr[i][j] != '.') {
-                char sym = boardArr[i][j];
-                if (i == startRow || j == BOARD_SIZE-1 || boardArr[i-1][j+1] != sym) {
-                    int ii = i, jj = j;
-                    while (ii < BOARD_SIZE && jj >= 0 && boardArr[ii][jj] == sym) {
-                        ii++; jj--;
-                    }
-                    int length = ii - i;
-                    bool leftOpen = (i-1 >= 0 && j+1 < BOARD_SIZE && boardArr[i-1][j+1] == '.');
-                    bool rightOpen = (ii < BOARD_SIZE && jj >= 0 && boardArr[ii][jj] == '.');
-                    if (length >= 5) {
-                        return (sym == myPlayer ? INF : -INF);
-                    }
-                    if (leftOpen || rightOpen) {
-                        if (sym == myPlayer) {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score += OPEN_FOUR; break;
-                                    case 3: score += OPEN_THREE; break;
-                                    case 2: score += OPEN_TWO; break;
-                                    case 1: score += ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score += CLOSED_FOUR; break;
-                                    case 3: score += CLOSED_THREE; break;
-                                    case 2: score += CLOSED_TWO; break;
-                                    case 1: score += 1; break;
-                                }
-                            }
-                        } else {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score -= OPEN_FOUR; break;
-                                    case 3: score -= OPEN_THREE; break;
-                                    case 2: score -= OPEN_TWO; break;
-                                    case 1: score -= ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score -= CLOSED_FOUR; break;
-                                    case 3: score -= CLOSED_THREE; break;
-                                    case 2: score -= CLOSED_TWO; break;
-                                    case 1: score -= 1; break;
-                                }
-                            }
-                        }
-                    }
-                    i = ii; j = jj;
-                    continue;
+
+    // Run playouts until a limit is reached or the stop flag is raised
+    static void mctsRun(int threadId) {
+        stats = SearchStats{};
+        searchAborted = false;
+        mctsPlayouts = 0;
+        mctsRng = hashKey ^ (0x9E3779B97F4A7C15ULL * (threadId + 1));
+        while (mctsPlayout()) mctsPlayouts++;
+    }
+
+    // Visits of every root move, added to `visits` (indexed by square)
+    static void mctsRootVisits(std::vector<uint64_t>& visits) {
+        const MctsNode& root = mctsTree[0];
+        if (root.state.load(std::memory_order_acquire) != MCTS_EXPANDED) return;
+        for (uint32_t c = root.firstChild; c < root.firstChild + root.childCount; ++c) {
+            visits[mctsTree[c].move] += mctsTree[c].visits.load(std::memory_order_relaxed);
+        }
+    }
+
+    // MCTS on the current position with numThreads threads, sharing this
+    // thread's tree or, in root-parallel mode, each on a tree of its own.
+    // The caller clears its stop flag before starting; it is raised here once
+    // the calling thread is done. Returns the most visited root move, or -1.
+    static int mctsSearch() {
+        int treeCount = mctsRootParallel ? numThreads : 1;
+        while ((int)mctsTrees.size() < treeCount) mctsTrees.emplace_back();
+        mctsUse(mctsTrees[0]);
+        mctsSetRoot();
+        std::vector<std::thread> helpers;
+        Bitboard rootPosition[2] = {stones[ME], stones[OPP]};
+        std::atomic<bool>* stop = searchStop;
+        auto start = startTime;
+        MctsTree* shared = mcts;
+        std::deque<MctsTree>& trees = mctsTrees;
+        char me = myPlayer;
+        std::vector<SearchStats> helperStats(numThreads);
+        std::vector<long> helperPlayouts(numThreads);
+        std::vector<uint64_t> rootVisits(NUM_SQUARES);
+        std::mutex rootLock;
+        for (int id = 1; id < numThreads; ++id) {
+            helpers.emplace_back([&, id]() {
+                searchStop = stop;
+                startTime = start;
+                myPlayer = me;
+                loadPosition(rootPosition);
+                if (mctsRootParallel) {
+                    mctsUse(trees[id]);
+                    mctsSetRoot();
+                } else {
+                    mcts = shared;
+                    mctsTree = shared->nodes.get();
                 }
+                mctsRun(id);
+                helperStats[id] = stats;
+                helperPlayouts[id] = mctsPlayouts;
+                if (mctsRootParallel) {
+                    std::lock_guard<std::mutex> guard(rootLock);
+                    mctsRootVisits(rootVisits);
+                }
+            });
+        }
+        mctsRun(0);
+        *stop = true;
+        for (std::thread& t : helpers) t.join();
+        helperStats[0] = stats;
+        helperPlayouts[0] = mctsPlayouts;
+        searchTotals = SearchStats{};
+        mctsTotalPlayouts = 0;
+        for (int id = 0; id < numThreads; ++id) {
+            searchTotals.nodes += helperStats[id].nodes;
+            mctsTotalPlayouts += helperPlayouts[id];
+        }
+        mctsRootVisits(rootVisits);
+        int best = -1;
+        uint64_t bestVisits = 0;
+        for (int sq = 0; sq < NUM_SQUARES; ++sq) {
+            if (rootVisits[sq] > bestVisits) {
+                bestVisits = rootVisits[sq];
+                best = sq;
             }
-            i++; j--;
         }
+        return best;
     }
-    for (int startCol = BOARD_SIZE - 2; startCol >= 0; --startCol) {
-        // start at last column and each row from 1 to end for remaining anti-diagonals
-        int i = 0, j = startCol;
-        while (i < BOARD_SIZE && j >= 0) {
-            if (boardArr[i][j] != '.') {
-                char sym = boardArr[i][j];
-                if (i == 0 || j == startCol || boardArr[i-1][j+1] != sym) {
-                    int ii = i, jj = j;
-                    while (ii < BOARD_SIZE && jj >= 0 && boardArr[ii][jj] == sym) {
-                        ii++; jj--;
-                    }
-                    int length = ii - i;
-                    bool leftOpen = (i-1 >= 0 && j+1 < BOARD_SIZE && boardArr[i-1][j+1] == '.');
-                    bool rightOpen = (ii < BOARD_SIZE && jj >= 0 && boardArr[ii][jj] == '.');
-                    if (length >= 5) {
-                        return (sym == myPlayer ? INF : -INF);
-                    }
-                    if (leftOpen || rightOpen) {
-                        if (sym == myPlayer) {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score += OPEN_FOUR; break;
-                                    case 3: score += OPEN_THREE; break;
-                                    case 2: score += OPEN_TWO; break;
-                                    case 1: score += ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score += CLOSED_FOUR; break;
-                                    case 3: score += CLOSED_THREE; break;
-                                    case 2: score += CLOSED_TWO; break;
-                                    case 1: score += 1; break;
-                                }
-                            }
-                        } else {
-                            if (leftOpen && rightOpen) {
-                                switch(length) {
-                                    case 4: score -= OPEN_FOUR; break;
-                                    case 3: score -= OPEN_THREE; break;
-                                    case 2: score -= OPEN_TWO; break;
-                                    case 1: score -= ONE_PIECE; break;
-                                }
-                            } else {
-                                switch(length) {
-                                    case 4: score -= CLOSED_FOUR; break;
-                                    case 3: score -= CLOSED_THREE; break;
-                                    case 2: score -= CLOSED_TWO; break;
-                                    case 1: score -= 1; break;
-                                }
-                            }
-                        }
+
+    // Most visited move at `node`, or -1 if it has no visited child
+    static int mctsBestMove(uint32_t node) {
+        const MctsNode& n = mctsTree[node];
+        if (n.state.load(std::memory_order_acquire) != MCTS_EXPANDED) return -1;
+        int best = -1;
+        uint32_t bestVisits = 0;
+        for (uint32_t c = n.firstChild; c < n.firstChild + n.childCount; ++c) {
+            uint32_t visits = mctsTree[c].visits.load(std::memory_order_relaxed);
+            if (visits > bestVisits) {
+                bestVisits = visits;
+                best = mctsTree[c].move;
+            }
+        }
+        return best;
+    }
+
+    // Principal variation from the transposition table, starting with ME
+    // playing `move` in the current position
+    static std::vector<int> principalVariation(int move) {
+        std::vector<int> pv;
+        int side = ME;
+        while (move >= 0 && move < NUM_SQUARES && emptySquares().test(move) && (int)pv.size() < MAX_DEPTH) {
+            pv.push_back(move);
+            placeStone(move, side);
+            if (checkFiveInRow(move, side)) break;
+            side = 1 - side;
+            TTProbe probe;
+            move = ttProbe(hashKey ^ (side == ME ? 0 : ZOBRIST_OPP_TO_MOVE), probe) ? probe.move : NO_MOVE;
+        }
+        for (int i = (int)pv.size() - 1; i >= 0; --i) removeStone(pv[i], i % 2 == 0 ? ME : OPP);
+        return pv;
+    }
+
+    // Write how the move was chosen to stderr as one JSON line: the source
+    // ("win", "block", "centre", "book", "cache", "threat", "search" or
+    // "mcts") and, for a search, its counters, the completed iterations and
+    // the principal variation; for MCTS, the playouts, the tree and the most
+    // visited line
+    static void reportStats(const std::string& source, int move) {
+        auto coords = [](int sq) { return json::array({sq / STRIDE, sq % STRIDE}); };
+        json out = {{"source", source}, {"move", coords(move)}};
+        if (source == "threat") out["threatNodes"] = threatNodes;
+        if (source == "search") {
+            const SearchStats& s = searchTotals;
+            auto rate = [](long part, long whole) { return whole ? double(part) / whole : 0.0; };
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - startTime;
+            out["threads"] = numThreads;
+            if (iterationCount) {
+                out["depth"] = iterations[iterationCount - 1].depth;
+                out["score"] = iterations[iterationCount - 1].score;
+            }
+            out["nodes"] = s.nodes;
+            out["leafEvals"] = s.leafEvals;
+            out["ttHitRate"] = rate(s.ttHits, s.ttProbes);
+            out["cutoffRate"] = rate(s.cutoffs, s.expanded);
+            out["firstMoveCutoffRate"] = rate(s.firstCutoffs, s.cutoffs);
+            out["timeMs"] = ms.count();
+            out["nps"] = ms.count() > 0 ? long(s.nodes * 1000.0 / ms.count()) : 0L;
+            json its = json::array();
+            for (int i = 0; i < iterationCount; ++i) {
+                const IterationInfo& it = iterations[i];
+                its.push_back({{"depth", it.depth}, {"score", it.score}, {"nodes", it.nodes}, {"timeMs", it.ms}});
+            }
+            out["iterations"] = its;
+            json pv = json::array();
+            for (int sq : principalVariation(move)) pv.push_back(coords(sq));
+            out["pv"] = pv;
+        }
+        if (source == "mcts") {
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - startTime;
+            out["threads"] = numThreads;
+            out["playouts"] = mctsTotalPlayouts;
+            out["nodes"] = searchTotals.nodes;
+            // In root-parallel mode every thread's tree counts; the line is
+            // read from the tree that searched the played move the most
+            uint64_t treeNodes = 0, reused = 0, rootVisits = 0, moveVisits = 0, moveValue = 0, lineVisits = 0;
+            size_t lineTree = 0;
+            size_t treeCount = mctsRootParallel ? std::min<size_t>(numThreads, mctsTrees.size()) : 1;
+            for (size_t t = 0; t < treeCount; ++t) {
+                mctsUse(mctsTrees[t]);
+                treeNodes += std::min(mcts->used.load(), mcts->capacity);
+                reused += mcts->reused;
+                rootVisits += mctsTree[0].visits.load();
+                if (uint32_t c = mctsChild(0, move)) {
+                    uint32_t visits = mctsTree[c].visits.load();
+                    moveVisits += visits;
+                    moveValue += mctsTree[c].value.load();
+                    if (visits > lineVisits) {
+                        lineVisits = visits;
+                        lineTree = t;
                     }
-                    i = ii; j = jj;
-                    continue;
                 }
             }
-            i++; j--;
+            out["treeNodes"] = treeNodes;
+            out["reusedVisits"] = reused;
+            out["rootVisits"] = rootVisits;
+            if (moveVisits) {
+                out["moveVisits"] = moveVisits;
+                out["winRate"] = double(moveValue) / (double(MCTS_VALUE_ONE) * moveVisits);
+            }
+            out["timeMs"] = ms.count();
+            out["playoutsPerSecond"] = ms.count() > 0 ? long(mctsTotalPlayouts * 1000.0 / ms.count()) : 0L;
+            mctsUse(mctsTrees[lineTree]);
+            json pv = json::array({coords(move)});
+            for (uint32_t node = mctsChild(0, move); node && mctsTree[node].visits.load(); ) {
+                int next = mctsBestMove(node);
+                if (next < 0) break;
+                pv.push_back(coords(next));
+                node = mctsChild(node, next);
+            }
+            mctsUse(mctsTrees[0]);
+            out["pv"] = pv;
         }
+        std::cerr << out.dump() + "\n";
     }
-    return score;
-}
 
-// Minimax search with alpha-beta pruning. Returns best score for current player.
-int searchMinimax(int depth, bool maximizingPlayer, int alpha, int beta) {
-    if (std::chrono::steady_clock::now() - startTime >= timeLimit) {
-        throw TimeOutException();
+    // Canonical key of the position: the smallest hash of its eight
+    // symmetric images. Sets `transform` to a symmetry giving it.
+    static uint64_t canonicalKey(int& transform) {
+        transform = 0;
+        for (int t = 1; t < NUM_SYMMETRIES; ++t) {
+            if (symmetricKey[t] < symmetricKey[transform]) transform = t;
+        }
+        return symmetricKey[transform];
     }
-    if (depth == 0) {
-        return evaluateBoard();
+
+    // `move` in the canonical orientation. A symmetric position has several;
+    // moves that are images of each other under them map to the same square.
+    static int canonicalMove(int move) {
+        uint64_t key = *std::min_element(symmetricKey, symmetricKey + NUM_SYMMETRIES);
+        int canonical = NUM_SQUARES;
+        for (int t = 0; t < NUM_SYMMETRIES; ++t) {
+            if (symmetricKey[t] == key) canonical = std::min(canonical, symmetry[t][move]);
+        }
+        return canonical;
     }
-    if (maximizingPlayer) {
-        int bestVal = -INF;
-        // Generate candidate moves for myPlayer
-        std::vector<std::pair<int,int>> moves;
-        moves.reserve(100);
-        bool anyPiece = false;
-        for (int r = 0; r < BOARD_SIZE; ++r) {
-            for (int c = 0; c < BOARD_SIZE; ++c) {
-                if (boardArr[r][c] != '.') {
-                    anyPiece = true;
-                    break;
-                }
-            }
-            if (anyPiece) break;
+
+    // Square of the board for a move stored in the canonical orientation
+    // given by `transform`
+    static int fromCanonical(int move, int transform) {
+        return symmetry[inverseSymmetry[transform]][move];
+    }
+
+    // Book move for the current position, or -1
+    static int bookMove() {
+        int transform;
+        const BookEntry* entry = bookFind(canonicalKey(transform));
+        if (!entry) return -1;
+        if (entry->move >= NUM_SQUARES) return -1;
+        int sq = fromCanonical(entry->move, transform);
+        return emptySquares().test(sq) ? sq : -1;
+    }
+
+    // Move stored in the result cache for the current position, or -1. Only
+    // alpha-beta results of at least cacheMinDepth count, and for MCTS also
+    // earlier MCTS results (depth 0).
+    static int cachedMove() {
+        int transform;
+        TTProbe probe;
+        if (!cacheProbe(canonicalKey(transform), probe) || probe.move >= NUM_SQUARES) return -1;
+        if (probe.depth < cacheMinDepth && !(mctsEnabled && probe.depth == 0)) return -1;
+        int sq = fromCanonical(probe.move, transform);
+        return emptySquares().test(sq) ? sq : -1;
+    }
+
+    // Record the result of the search just finished. MCTS results are
+    // stored at depth 0, below any alpha-beta result. Searches cut short by
+    // --nodes or --depth are not stored: they say nothing about what a
+    // search on the clock would play.
+    static void storeCachedMove(int move) {
+        if ((!mctsEnabled && !iterationCount) || nodeLimit || depthLimit < MAX_DEPTH) return;
+        int transform;
+        uint64_t key = canonicalKey(transform);
+        const IterationInfo* last = mctsEnabled ? nullptr : &iterations[iterationCount - 1];
+        cacheStore(key, last ? last->score : 0, canonicalMove(move), last ? last->depth : 0);
+    }
+
+    // Choose the best move for myPlayer from the current board state
+    static std::pair<int,int> choose_move() {
+        auto chosen = [](const char* source, int sq) {
+            if (statsEnabled) reportStats(source, sq);
+            return std::make_pair(sq / STRIDE, sq % STRIDE);
+        };
+        // 1. Immediate win check
+        Bitboard wins = winningSquares(ME);
+        if (wins.any()) return chosen("win", wins.lowest());
+        // 2. Immediate block opponent's win
+        Bitboard blocks = winningSquares(OPP);
+        if (blocks.any()) return chosen("block", blocks.lowest());
+        // 3. If board is empty, play in the center
+        if (!occupied().any()) {
+            int center = BOARD_SIZE / 2;
+            return chosen("centre", squareOf(center, center));
         }
-        if (!anyPiece) {
-            // no pieces on board, choose center
-            moves.emplace_back(BOARD_SIZE/2, BOARD_SIZE/2);
-        } else {
-            for (int r = 0; r < BOARD_SIZE; ++r) {
-                for (int c = 0; c < BOARD_SIZE; ++c) {
-                    if (boardArr[r][c] == '.') {
-                        // if neighbor within 2 cells exists
-                        bool neighbor = false;
-                        for (int dr = -2; dr <= 2 && !neighbor; ++dr) {
-                            for (int dc = -2; dc <= 2 && !neighbor; ++dc) {
-                                if (dr == 0 && dc == 0) continue;
-                                int rr = r + dr, cc = c + dc;
-                                if (rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE 
-                                    && boardArr[rr][cc] != '.') {
-                                    neighbor = true;
-                                }
-                            }
-                        }
-                        if (neighbor) {
-                            moves.emplace_back(r, c);
-                        }
-                    }
+        // A full board has no move to play: answer (-1, -1), as for no move
+        if (!emptySquares().any()) return std::make_pair(-1, -1);
+        // 4. Play the book move if the position is in the opening book
+        int book = bookMove();
+        if (book != -1) return chosen("book", book);
+        // 5. Play the result of an earlier search of this position, by this
+        // or another process, if the result cache has one
+        int cached = cachedMove();
+        if (cached != -1) return chosen("cache", cached);
+        // 6. Play a forced win by continuous fours or threats if one exists
+        int threatMove = findThreatWin();
+        if (threatMove != -1) return chosen("threat", threatMove);
+        // 7. Search for the best move using iterative deepening, or MCTS
+        *searchStop = false;
+        int bestMove = mctsEnabled ? mctsSearch() : parallelSearch();
+        if (bestMove != -1) storeCachedMove(bestMove);
+        // Fallback: if no move was found (should not happen, but just in case)
+        if (bestMove == -1) bestMove = emptySquares().lowest();
+        return chosen(mctsEnabled ? "mcts" : "search", bestMove);
+    }
+
+    // Set myPlayer and the board from a parsed state.json object. Returns false
+    // with a message in `error` if the state does not have the expected shape.
+    static bool loadState(const json& state, std::string& error) {
+        if (!state.is_object() || !state.contains("board") || !state.contains("player")) {
+            error = "state must have \"board\" and \"player\"";
+            return false;
+        }
+        const json& boardData = state["board"];
+        const json& player = state["player"];
+        if (!player.is_string() || (player != "X" && player != "O")) {
+            error = "Invalid player value in JSON";
+            return false;
+        }
+        if (!boardData.is_array() || (int)boardData.size() != BOARD_SIZE) {
+            error = "board must have " + std::to_string(BOARD_SIZE) + " rows";
+            return false;
+        }
+        Bitboard position[2] = {};
+        char me = player.get<std::string>()[0];
+        for (int i = 0; i < BOARD_SIZE; ++i) {
+            if (!boardData[i].is_array() || (int)boardData[i].size() != BOARD_SIZE) {
+                error = "board rows must have " + std::to_string(BOARD_SIZE) + " cells";
+                return false;
+            }
+            for (int j = 0; j < BOARD_SIZE; ++j) {
+                const json& cell = boardData[i][j];
+                if (!cell.is_string()) {
+                    error = "board cells must be strings";
+                    return false;
                 }
+                const std::string& sym = cell.get_ref<const std::string&>();
+                if (sym.empty()) continue;
+                // should be "X" or "O"
+                position[sym[0] == me ? ME : OPP].set(squareOf(i, j));
             }
         }
-        if (moves.empty()) {
-            // if somehow no moves found (shouldn't happen unless board full)
-            for (int r = 0; r < BOARD_SIZE; ++r) {
-                for (int c = 0; c < BOARD_SIZE; ++c) {
-                    if (boardArr[r][c] == '.') moves.emplace_back(r, c);
+        setState(me, position);
+        return true;
+    }
+
+    // Same as loadState() for a state read by parseStateFast()
+    static bool loadParsedState(const ParsedState& state, std::string& error) {
+        if (state.size != BOARD_SIZE) {
+            error = "board must have " + std::to_string(BOARD_SIZE) + " rows";
+            return false;
+        }
+        Bitboard position[2] = {};
+        int meIndex = (state.player == 'O');
+        for (int i = 0; i < BOARD_SIZE; ++i) {
+            for (int sym = 0; sym < 2; ++sym) {
+                uint32_t row = state.rows[sym][i];
+                while (row) {
+                    int j = __builtin_ctz(row);
+                    row &= row - 1;
+                    position[sym == meIndex ? ME : OPP].set(squareOf(i, j));
                 }
             }
         }
-        // Move ordering: sort moves by heuristic value (descending)
-        std::sort(moves.begin(), moves.end(), [&](const std::pair<int,int>& a, const std::pair<int,int>& b) {
-            boardArr[a.first][a.second] = myPlayer;
-            int evalA = evaluateBoard();
-            boardArr[a.first][a.second] = '.';
-            boardArr[b.first][b.second] = myPlayer;
-            int evalB = evaluateBoard();
-            boardArr[b.first][b.second] = '.';
-            return evalA > evalB;
-        });
-        for (auto& mv : moves) {
-            int r = mv.first, c = mv.second;
-            boardArr[r][c] = myPlayer;
-            int moveScore;
-            if (checkFiveInRow(r, c, myPlayer)) {
-                // immediate win achieved
-                moveScore = INF;
+        setState(state.player, position);
+        return true;
+    }
+
+    static void setState(char me, const Bitboard position[2]) {
+        myPlayer = me;
+        oppPlayer = (myPlayer == 'X' ? 'O' : 'X');
+        loadPosition(position);
+    }
+
+    // Load a state from JSON text: the fast reader first, nlohmann::json for
+    // anything it does not accept
+    static bool loadStateText(const std::string& text, std::string& error) {
+        ParsedState parsed;
+        if (parseStateFast(text.data(), text.size(), parsed)) return loadParsedState(parsed, error);
+        try {
+            return loadState(json::parse(text), error);
+        } catch (const std::exception& e) {
+            error = std::string("Failed to parse state: ") + e.what();
+            return false;
+        }
+    }
+
+    static std::string formatMove(std::pair<int,int> move) {
+        return "[" + std::to_string(move.first) + ", " + std::to_string(move.second) + "]";
+    }
+
+    // Search the loaded position with the clock started at `start`
+    static std::pair<int,int> answerMove(std::chrono::steady_clock::time_point start) {
+        startTime = start;
+        return choose_move();
+    }
+
+    // -----------------------------------------------------------------------
+    // Daemon mode
+    //
+    // States arrive one JSON object per line (on stdin or a Unix domain socket)
+    // and each is answered with a "[row, col]" line. The transposition table and
+    // all allocations live for the whole process; the table is only cleared when
+    // a state cannot follow from the previous one, i.e. a new game has started.
+    // -----------------------------------------------------------------------
+    static inline Bitboard gamePosition[2];
+    static inline char gamePlayer;
+
+    // Pondering: after answering, guess the opponent's reply from the table and
+    // search the resulting position in the background until the next state
+    // arrives. The work carries over through the shared transposition table.
+    static inline std::thread ponderThread;
+
+    static void stopPondering() {
+        if (!ponderThread.joinable()) return;
+        stopSearch = true;
+        ponderThread.join();
+        pondering = false;
+    }
+
+    // Start pondering after playing `move` in the loaded position
+    static void startPondering(int move) {
+        if (move < 0 || move >= NUM_SQUARES || !emptySquares().test(move)) return;
+        placeStone(move, ME);
+        int reply = NO_MOVE;
+        bool gameOver = checkFiveInRow(move, ME) || !emptySquares().any();
+        if (!gameOver) {
+            TTProbe probe;
+            if (ttProbe(hashKey ^ ZOBRIST_OPP_TO_MOVE, probe) && probe.move != NO_MOVE
+                && emptySquares().test(probe.move)) {
+                reply = probe.move;
             } else {
-                moveScore = searchMinimax(depth - 1, false, alpha, beta);
+                MoveList replies;
+                generateMoves(replies, OPP, NO_MOVE, 1);
+                if (replies.count) reply = pickNext(replies, 0);
             }
-            boardArr[r][c] = '.';
-            if (moveScore > bestVal) {
-                bestVal = moveScore;
+        }
+        if (reply != NO_MOVE) {
+            placeStone(reply, OPP);
+            gameOver = checkFiveInRow(reply, OPP) || !emptySquares().any();
+            Bitboard predicted[2] = {stones[ME], stones[OPP]};
+            removeStone(reply, OPP);
+            if (!gameOver) {
+                pondering = true;
+                stopSearch = false;
+                ponderThread = std::thread([predicted]() {
+                    loadPosition(predicted);
+                    parallelSearch();
+                });
             }
-            if (moveScore > alpha) {
-                alpha = moveScore;
+        }
+        removeStone(move, ME);
+    }
+
+    static std::string handleStateLine(const std::string& line) {
+        auto received = std::chrono::steady_clock::now();
+        stopPondering();
+        std::string error;
+        if (!loadStateText(line, error)) return "ERROR: " + error;
+        // Stones never disappear within a game, so any lost stone means a new game
+        bool sameGame = myPlayer == gamePlayer
+            && !(gamePosition[ME] & ~stones[ME]).any()
+            && !(gamePosition[OPP] & ~stones[OPP]).any();
+        if (!sameGame) ttClear();
+        gamePosition[ME] = stones[ME];
+        gamePosition[OPP] = stones[OPP];
+        gamePlayer = myPlayer;
+
+        std::pair<int,int> move = answerMove(received);
+        // Nothing to ponder after (-1, -1): the board is full
+        if (ponderEnabled && move.first >= 0) startPondering(squareOf(move.first, move.second));
+        return formatMove(move);
+    }
+
+    static bool isBlank(const std::string& line) {
+        return line.find_first_not_of(" \t\r") == std::string::npos;
+    }
+
+    static int serveStdin() {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (isBlank(line)) continue;
+            std::cout << handleStateLine(line) << std::endl;
+        }
+        stopPondering();
+        return 0;
+    }
+
+    static bool writeAll(int fd, const std::string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
             }
-            if (alpha >= beta) {
-                // beta cut-off
-                break;
+            done += n;
+        }
+        return true;
+    }
+
+    // Serve one client at a time; each connection may send any number of states
+    static int serveSocket(const char* path) {
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server < 0) {
+            perror("socket");
+            return 1;
+        }
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (std::strlen(path) >= sizeof(addr.sun_path)) {
+            std::cerr << "ERROR: socket path too long\n";
+            close(server);
+            return 1;
+        }
+        std::strcpy(addr.sun_path, path);
+        // Only replace a stale socket; never delete a file the user named by mistake
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                std::cerr << "ERROR: " << path << " exists and is not a socket\n";
+                close(server);
+                return 1;
             }
-            if (bestVal == INF) {
-                // found a winning move, no need to search further at this depth
+            unlink(path);
+        }
+        if (bind(server, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, 8) < 0) {
+            perror("bind");
+            close(server);
+            return 1;
+        }
+        for (;;) {
+            int client = accept(server, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR) continue;
+                perror("accept");
                 break;
             }
-        }
-        return bestVal;
-    } else {  // minimizing player (opponent's turn)
-        int bestVal = INF;
-        std::vector<std::pair<int,int>> moves;
-        moves.reserve(100);
-        bool anyPiece = false;
-        for (int r = 0; r < BOARD_SIZE; ++r) {
-            for (int c = 0; c < BOARD_SIZE; ++c) {
-                if (boardArr[r][c] != '.') {
-                    anyPiece = true;
+            std::string pending;
+            char buf[4096];
+            ssize_t n;
+            bool open = true;
+            while (open && (n = read(client, buf, sizeof(buf))) != 0) {
+                if (n < 0) {
+                    if (errno == EINTR) continue;
                     break;
                 }
-            }
-            if (anyPiece) break;
-        }
-        if (!anyPiece) {
-            moves.emplace_back(BOARD_SIZE/2, BOARD_SIZE/2);
-        } else {
-            for (int r = 0; r < BOARD_SIZE; ++r) {
-                for (int c = 0; c < BOARD_SIZE; ++c) {
-                    if (boardArr[r][c] == '.') {
-                        bool neighbor = false;
-                        for (int dr = -2; dr <= 2 && !neighbor; ++dr) {
-                            for (int dc = -2; dc <= 2 && !neighbor; ++dc) {
-                                if (dr == 0 && dc == 0) continue;
-                                int rr = r + dr, cc = c + dc;
-                                if (rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE 
-                                    && boardArr[rr][cc] != '.') {
-                                    neighbor = true;
-                                }
-                            }
-                        }
-                        if (neighbor) {
-                            moves.emplace_back(r, c);
-                        }
-                    }
+                pending.append(buf, n);
+                size_t pos;
+                while (open && (pos = pending.find('\n')) != std::string::npos) {
+                    std::string line = pending.substr(0, pos);
+                    pending.erase(0, pos + 1);
+                    if (isBlank(line)) continue;
+                    open = writeAll(client, handleStateLine(line) + "\n");
                 }
             }
+            close(client);
         }
-        if (moves.empty()) {
-            for (int r = 0; r < BOARD_SIZE; ++r) {
-                for (int c = 0; c < BOARD_SIZE; ++c) {
-                    if (boardArr[r][c] == '.') moves.emplace_back(r, c);
-                }
+        stopPondering();
+        close(server);
+        unlink(path);
+        return 1;
+    }
+
+    // -----------------------------------------------------------------------
+    // Batch mode
+    //
+    // Answers every state in a JSONL file (one state per line) or in a
+    // directory of state files (in name order), printing one line per state
+    // in input order: the move, or an ERROR line. Tables are set up once for
+    // the whole run; positions are searched with the per-move time and node
+    // limits as they are, without any game tracking.
+    //
+    // States are read in chunks and each chunk is shared out over
+    // batchWorkers threads, each with its own board and search state.
+    // Items are dealt round-robin onto one deque per worker; a worker takes
+    // the lowest index from its own deque and, once that is empty, steals
+    // the highest index from another's, so a few slow positions do not leave
+    // the other workers idle. Results go into one slot per item and are
+    // printed in input order once the chunk is done.
+    // -----------------------------------------------------------------------
+    static constexpr size_t BATCH_CHUNK = 4096;
+
+    struct WorkDeque {
+        std::mutex lock;
+        std::deque<size_t> items;
+    };
+    static std::string answerStateText(const std::string& text) {
+        auto start = std::chrono::steady_clock::now();
+        std::string error;
+        if (!loadStateText(text, error)) return "ERROR: " + error;
+        return formatMove(answerMove(start));
+    }
+
+    // Next item for worker `self`: its own lowest, else one stolen from another
+    static bool nextItem(std::vector<WorkDeque>& deques, int self, size_t& item) {
+        {
+            WorkDeque& own = deques[self];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.items.empty()) {
+                item = own.items.front();
+                own.items.pop_front();
+                return true;
             }
         }
-        // Sort moves by heuristic (ascending, since opponent tries to minimize our score)
-        std::sort(moves.begin(), moves.end(), [&](const std::pair<int,int>& a, const std::pair<int,int>& b) {
-            boardArr[a.first][a.second] = oppPlayer;
-            int evalA = evaluateBoard();
-            boardArr[a.first][a.second] = '.';
-            boardArr[b.first][b.second] = oppPlayer;
-            int evalB = evaluateBoard();
-            boardArr[b.first][b.second] = '.';
-            return evalA < evalB;
-        });
-        for (auto& mv : moves) {
-            int r = mv.first, c = mv.second;
-            boardArr[r][c] = oppPlayer;
-            int moveScore;
-            if (checkFiveInRow(r, c, oppPlayer)) {
-                moveScore = -INF;
-            } else {
-                moveScore = searchMinimax(depth - 1, true, alpha, beta);
+        for (size_t k = 1; k < deques.size(); ++k) {
+            WorkDeque& victim = deques[(self + k) % deques.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.items.empty()) {
+                item = victim.items.back();
+                victim.items.pop_back();
+                return true;
             }
-            boardArr[r][c] = '.';
-            if (moveScore < bestVal) {
-                bestVal = moveScore;
+        }
+        return false;
+    }
+
+    static void answerBatch(const std::vector<std::string>& inputs, std::vector<std::string>& outputs) {
+        outputs.assign(inputs.size(), std::string());
+        int workers = int(std::min<size_t>(batchWorkers, inputs.size()));
+        if (workers <= 1) {
+            for (size_t i = 0; i < inputs.size(); ++i) outputs[i] = answerStateText(inputs[i]);
+            return;
+        }
+        std::vector<WorkDeque> deques(workers);
+        for (size_t i = 0; i < inputs.size(); ++i) deques[i % workers].items.push_back(i);
+        std::vector<std::thread> threads;
+        for (int w = 0; w < workers; ++w) {
+            threads.emplace_back([&, w]() {
+                std::atomic<bool> stop(false);
+                searchStop = &stop;
+                size_t item;
+                while (nextItem(deques, w, item)) outputs[item] = answerStateText(inputs[item]);
+            });
+        }
+        for (std::thread& t : threads) t.join();
+    }
+
+    static int runBatch(const char* path) {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        std::vector<std::string> inputs, outputs;
+        auto flush = [&]() {
+            answerBatch(inputs, outputs);
+            for (const std::string& out : outputs) std::cout << out << '\n';
+            inputs.clear();
+        };
+        if (fs::is_directory(path, ec)) {
+            std::vector<fs::path> files;
+            for (const fs::directory_entry& entry : fs::directory_iterator(path, ec)) {
+                if (entry.is_regular_file()) files.push_back(entry.path());
             }
-            if (moveScore < beta) {
-                beta = moveScore;
+            std::sort(files.begin(), files.end());
+            for (const fs::path& file : files) {
+                std::ifstream f(file, std::ios::binary);
+                inputs.emplace_back(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+                if (inputs.size() == BATCH_CHUNK) flush();
             }
-            if (alpha >= beta) {
-                break;
+        } else {
+            std::ifstream f(path);
+            if (!f) {
+                std::cerr << "ERROR: cannot open " << path << "\n";
+                return 1;
             }
-            if (bestVal == -INF) {
-                break;
+            std::string line;
+            while (std::getline(f, line)) {
+                if (isBlank(line)) continue;
+                inputs.push_back(line);
+                if (inputs.size() == BATCH_CHUNK) flush();
             }
         }
-        return bestVal;
+        flush();
+        if (ec) {
+            std::cerr << "ERROR: " << path << ": " << ec.message() << "\n";
+            return 1;
+        }
+        std::cout.flush();
+        return 0;
+    }
+
+    // -----------------------------------------------------------------------
+    // Book building
+    //
+    // Counts the moves played in the first `plies` plies of many games by
+    // canonical position and writes them out as a book. Games are read from
+    // a log, one JSON object per line, {"moves": [[row, col], ...], "winner":
+    // "X"}, with X moving first and the winner optional. Without a log the
+    // engine plays them itself under the usual time and node limits: in
+    // even games X takes the centre, the engine answers for O and X's next
+    // move is random near the centre; in odd games X opens at random near
+    // the centre. The engine plays every other move, for both sides, by
+    // default with BOOK_MOVETIME per move. A move weighs 2 for the side that won, 0 for the
+    // side that lost and 1 otherwise; moves that weigh nothing are left out.
+    // -----------------------------------------------------------------------
+    static constexpr int BOOK_PLIES = 10;
+    static constexpr int BOOK_GAMES = 100;
+    static constexpr int BOOK_SPREAD = 2;  // random openings stay this close to the centre
+
+    using BookCounts = std::map<std::pair<uint64_t, int>, uint32_t>;
+
+    // Count `mover` playing `move` in `position` (X's stones, then O's)
+    static void countBookMove(BookCounts& counts, const Bitboard position[2], char mover, int move, uint32_t weight) {
+        Bitboard own[2] = {position[mover == 'X' ? 0 : 1], position[mover == 'X' ? 1 : 0]};
+        setState(mover, own);
+        int transform;
+        uint64_t key = canonicalKey(transform);
+        counts[{key, canonicalMove(move)}] += weight;
     }
-}
 
-// Choose the best move for myPlayer from the current board state
-std::pair<int,int> choose_move() {
-    // 1. Immediate win check
-    for (int r = 0; r < BOARD_SIZE; ++r) {
-        for (int c = 0; c < BOARD_SIZE; ++c) {
-            if (boardArr[r][c] == '.') {
-                boardArr[r][c] = myPlayer;
-                if (checkFiveInRow(r, c, myPlayer)) {
-                    boardArr[r][c] = '.';  // revert
-                    return {r, c};
+    static void countLoggedGames(BookCounts& counts, std::istream& in, int plies, std::string& error) {
+        std::string line;
+        for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+            if (isBlank(line)) continue;
+            json game = json::parse(line, nullptr, false);
+            if (!game.is_object() || !game.contains("moves") || !game["moves"].is_array()) {
+                error = "line " + std::to_string(lineNo) + ": expected {\"moves\": [[row, col], ...]}";
+                return;
+            }
+            std::string winner = game.contains("winner") && game["winner"].is_string() ? game["winner"].get<std::string>() : "";
+            Bitboard position[2] = {};
+            int ply = 0;
+            for (const json& m : game["moves"]) {
+                if (ply == plies) break;
+                char mover = ply % 2 ? 'O' : 'X';
+                int r = m.is_array() && m.size() == 2 && m[0].is_number_integer() ? m[0].get<int>() : -1;
+                int c = m.is_array() && m.size() == 2 && m[1].is_number_integer() ? m[1].get<int>() : -1;
+                if (r < 0 || r >= BOARD_SIZE || c < 0 || c >= BOARD_SIZE
+                    || position[0].test(squareOf(r, c)) || position[1].test(squareOf(r, c))) {
+                    error = "line " + std::to_string(lineNo) + ": bad move " + m.dump();
+                    return;
                 }
-                boardArr[r][c] = '.';
+                uint32_t weight = winner.empty() || (winner != "X" && winner != "O") ? 1 : winner[0] == mover ? 2 : 0;
+                if (weight) countBookMove(counts, position, mover, squareOf(r, c), weight);
+                position[ply % 2].set(squareOf(r, c));
+                ++ply;
             }
         }
     }
-    // 2. Immediate block opponent's win
-    for (int r = 0; r < BOARD_SIZE; ++r) {
-        for (int c = 0; c < BOARD_SIZE; ++c) {
-            if (boardArr[r][c] == '.') {
-                boardArr[r][c] = oppPlayer;
-                if (checkFiveInRow(r, c, oppPlayer)) {
-                    boardArr[r][c] = '.';
-                    return {r, c};
+
+    static void countSelfPlayGames(BookCounts& counts, int games, int plies) {
+        int centre = BOARD_SIZE / 2;
+        for (int g = 0; g < games; ++g) {
+            uint64_t seed = g;
+            Bitboard position[2] = {};
+            auto nearCentre = [&]() {
+                for (;;) {
+                    int r = centre - BOOK_SPREAD + int(splitmix64(seed) % (2 * BOOK_SPREAD + 1));
+                    int c = centre - BOOK_SPREAD + int(splitmix64(seed) % (2 * BOOK_SPREAD + 1));
+                    int sq = squareOf(r, c);
+                    if (!position[0].test(sq) && !position[1].test(sq)) return sq;
+                }
+            };
+            // Even games: X's second move is the random one, so the engine's
+            // reply to the centre is in the book; odd games: X's first
+            int randomPly = g % 2 == 0 ? 2 : 0;
+            int ply = 0;
+            if (g % 2 == 0) position[ply++].set(squareOf(centre, centre));
+            for (; ply < plies; ++ply) {
+                if (ply == randomPly) {
+                    position[ply % 2].set(nearCentre());
+                    continue;
                 }
-                boardArr[r][c] = '.';
+                char mover = ply % 2 ? 'O' : 'X';
+                Bitboard own[2] = {position[ply % 2], position[1 - ply % 2]};
+                setState(mover, own);
+                if (!emptySquares().any()) break;
+                std::pair<int,int> move = answerMove(std::chrono::steady_clock::now());
+                int sq = squareOf(move.first, move.second);
+                countBookMove(counts, position, mover, sq, 1);
+                position[ply % 2].set(sq);
+                setState(mover, own);
+                placeStone(sq, ME);
+                if (checkFiveInRow(sq, ME)) break;
             }
         }
     }
-    // 3. If board is empty, play in the center
-    bool anyPiece = false;
-    for (int r = 0; r < BOARD_SIZE && !anyPiece; ++r) {
-        for (int c = 0; c < BOARD_SIZE && !anyPiece; ++c) {
-            if (boardArr[r][c] != '.') {
-                anyPiece = true;
+
+    static int buildBook(const char* out, const char* logPath, int games, int plies) {
+        BookCounts counts;
+        if (logPath) {
+            std::ifstream in(logPath);
+            if (!in) {
+                std::cerr << "ERROR: cannot open " << logPath << "\n";
+                return 1;
             }
+            std::string error;
+            countLoggedGames(counts, in, plies, error);
+            if (!error.empty()) {
+                std::cerr << "ERROR: " << logPath << ": " << error << "\n";
+                return 1;
+            }
+        } else {
+            countSelfPlayGames(counts, games, plies);
         }
+        std::vector<BookEntry> entries;
+        for (const auto& [keyMove, weight] : counts) {
+            if (weight) entries.push_back({keyMove.first, uint16_t(keyMove.second), uint16_t(std::min<uint32_t>(weight, 0xFFFF)), 0});
+        }
+        // By key, heaviest first
+        std::sort(entries.begin(), entries.end(), [](const BookEntry& a, const BookEntry& b) {
+            return a.key != b.key ? a.key < b.key : a.weight != b.weight ? a.weight > b.weight : a.move < b.move;
+        });
+        BookHeader header = {};
+        std::memcpy(header.magic, BOOK_MAGIC, sizeof(BOOK_MAGIC));
+        header.boardSize = BOARD_SIZE;
+        header.winLength = WIN_LENGTH;
+        header.count = entries.size();
+        FILE* f = std::fopen(out, "wb");
+        bool ok = f && std::fwrite(&header, sizeof(header), 1, f) == 1
+            && std::fwrite(entries.data(), sizeof(BookEntry), entries.size(), f) == entries.size();
+        if (f && std::fclose(f) != 0) ok = false;
+        if (!ok) {
+            std::cerr << "ERROR: cannot write " << out << "\n";
+            return 1;
+        }
+        size_t positions = 0;
+        for (size_t i = 0; i < entries.size(); ++i) positions += i == 0 || entries[i].key != entries[i - 1].key;
+        std::cout << positions << " positions, " << entries.size() << " moves\n";
+        return 0;
     }
-    if (!anyPiece) {
-        int center = BOARD_SIZE / 2;
-        return {center, center};
-    }
-    // 4. Search for the best move using iterative deepening
-    std::pair<int,int> bestMove = {-1, -1};
-    int maxDepthReached = 0;
-    try {
-        for (int depth = 1; depth <= 15; ++depth) {
-            int alpha = -INF, beta = INF;
-            int bestScore = -INF;
-            std::pair<int,int> bestMoveThisDepth = {-1, -1};
-            // Generate moves (same approach as in searchMinimax for maximizing root)
-            std::vector<std::pair<int,int>> moves;
-            moves.reserve(100);
-            for (int r = 0; r < BOARD_SIZE; ++r) {
-                for (int c = 0; c < BOARD_SIZE; ++c) {
-                    if (boardArr[r][c] == '.') {
-                        bool neighbor = false;
-                        for (int dr = -2; dr <= 2 && !neighbor; ++dr) {
-                            for (int dc = -2; dc <= 2 && !neighbor; ++dc) {
-                                if (dr == 0 && dc == 0) continue;
-                                int rr = r + dr, cc = c + dc;
-                                if (rr >= 0 && rr < BOARD_SIZE && cc >= 0 && cc < BOARD_SIZE 
-                                    && boardArr[rr][cc] != '.') {
-                                    neighbor = true;
-                                }
-                            }
-                        }
-                        if (neighbor) {
-                            moves.emplace_back(r, c);
-                        }
-                    }
-                }
-            }
-            if (moves.empty()) {
-                for (int r = 0; r < BOARD_SIZE; ++r) {
-                    for (int c = 0; c < BOARD_SIZE; ++c) {
-                        if (boardArr[r][c] == '.') {
-                            moves.emplace_back(r, c);
-                        }
-                    }
-                }
-            }
-            // Move ordering at root
-            std::sort(moves.begin(), moves.end(), [&](const std::pair<int,int>& a, const std::pair<int,int>& b) {
-                boardArr[a.first][a.second] = myPlayer;
-                int evalA = evaluateBoard();
-                boardArr[a.first][a.second] = '.';
-                boardArr[b.first][b.second] = myPlayer;
-                int evalB = evaluateBoard();
-                boardArr[b.first][b.second] = '.';
-                return evalA > evalB;
-            });
-            for (auto& mv : moves) {
-                int r = mv.first, c = mv.second;
-                boardArr[r][c] = myPlayer;
-                int score;
-                if (checkFiveInRow(r, c, myPlayer)) {
-                    score = INF;
-                } else {
-                    score = searchMinimax(depth - 1, false, alpha, beta);
-                }
-                boardArr[r][c] = '.';
-                if (score > bestScore) {
-                    bestScore = score;
-                    bestMoveThisDepth = mv;
-                }
-                if (score > alpha) alpha = score;
-                if (alpha >= beta || bestScore == INF) {
-                    // cut off further moves at this depth
-                    break;
-                }
-            }
-            // If we complete the depth search successfully, store the result
-            bestMove = bestMoveThisDepth;
-            maxDepthReached = depth;
-            // If a winning move is found, we can break early
-            if (bestScore == INF) break;
+
+    // Answer a single state given either as read by parseStateFast() or as JSON
+    static int answerOnce(const ParsedState* parsed, const json* state) {
+        std::string error;
+        if (!(parsed ? loadParsedState(*parsed, error) : loadState(*state, error))) {
+            std::cerr << "ERROR: " << error << "\n";
+            return 1;
         }
-    } catch (const TimeOutException&) {
-        // Time limit reached during search; use bestMove from last completed depth
+        std::pair<int,int> move = answerMove(std::chrono::steady_clock::now());
+        std::cout<<"["<<move.first<<", "<<move.second<<"]\n";
+        return 0;
     }
-    // Fallback: if no move was found (should not happen, but just in case)
-    if (bestMove.first == -1) {
-        for (int r = 0; r < BOARD_SIZE; r++) {
-            for (int c = 0; c < BOARD_SIZE; c++) {
-                if (boardArr[r][c] == '.') {
-                    bestMove = {r, c};
-                    break;
-                }
+};
+
+// ---------------------------------------------------------------------------
+// Bench
+//
+// Searches a fixed suite of 10x10 positions to a fixed depth with one thread,
+// no clock, and an empty transposition table and move-ordering tables for
+// every position, so the node counts depend only on the code. It prints the
+// time, nodes and nodes per second, plus a signature of the moves and node
+// counts: an optimisation that must not change the search has to keep the
+// signature.
+// ---------------------------------------------------------------------------
+static const int BENCH_DEPTH = 6;
+static const size_t BENCH_HASH_MB = 16;
+
+// Side to move, then the rows top to bottom ('.' empty)
+static const char* const BENCH_POSITIONS[] = {
+    "X .......... .......... .......... ...O.X.... ....XO.... ....XXO... ...O...... .......... .......... ..........",
+    "O .......... .......... .......... ....X...X. ....X..O.. ......O... .....O.... .......... .......... ..........",
+    "O .......... .......... ......O... ....XXO.X. ....X.XO.. ...XO.O... ..X..O.... .O........ .......... ..........",
+    "O .......... .......... .......... .......... .......... ...X.X.... ..XOO.X... .......... .......... ..........",
+    "O .......... .......... ....X..... .....X.... .......... .......... ...XOOO... .......... .......... ..........",
+    "O X......... .O.....X.. ..X...X... ...XXXO... ....X..... ...O.O.... ...OO..... .......... .......... ..........",
+    "O .......... .......... ....X..... .....X.... ......X.X. .......O.. ...XOOO... .....O.... .......... ..........",
+    "O ..O....... ...X.X.... ....X..O.. .....X.X.. ..X...XOX. ...O...O.. ...XOOOOX. .....O.X.. ...OOXOO.. ...X...X..",
+    "O .......... .......... .......... .......X.. .X..O.X... ..OXXXXO.. ..XOO.X... ...OOXO... .......... ..........",
+    "X .......... .....X..X. .......... .......X.X .......... ...O...... .........O .O.O...... .......... ..........",
+};
+
+template<class E>
+static int runBench(int depth) {
+    using Clock = std::chrono::steady_clock;
+    using Bitboard = typename E::Bitboard;
+    ttResize(BENCH_HASH_MB);
+    timeLimit = NO_TIME_LIMIT;
+    nodeLimit = 0;
+    depthLimit = depth;
+    long totalNodes = 0;
+    uint64_t signature = 0xCBF29CE484222325ULL;  // FNV-1a over moves and node counts
+    Clock::duration elapsed{};
+    int count = int(sizeof(BENCH_POSITIONS) / sizeof(BENCH_POSITIONS[0]));
+    for (int i = 0; i < count; ++i) {
+        const char* text = BENCH_POSITIONS[i];
+        char me = text[0];
+        Bitboard position[2] = {};
+        for (int r = 0; r < 10; ++r) {
+            for (int c = 0; c < 10; ++c) {
+                char cell = text[2 + r * 11 + c];
+                if (cell != '.') position[cell == me ? ME : OPP].set(E::squareOf(r, c));
             }
-            if (bestMove.first != -1) break;
         }
+        E::setState(me, position);
+        ttClear();
+        ttNewSearch();
+        E::clearHistory();
+        *searchStop = false;
+        Clock::time_point start = Clock::now();
+        startTime = start;
+        int move = E::iterativeDeepening(0);
+        elapsed += Clock::now() - start;
+        long nodes = E::stats.nodes;
+        totalNodes += nodes;
+        for (uint64_t v : {uint64_t(move), uint64_t(nodes)}) {
+            signature = (signature ^ v) * 0x100000001B3ULL;
+        }
+        std::cout << "Position " << (i + 1) << "/" << count << ": move ["
+                  << move / E::STRIDE << ", " << move % E::STRIDE << "], nodes " << nodes << "\n";
     }
-    return bestMove;
+    long ms = long(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+    std::cout << "Depth          : " << depth << "\n"
+              << "Total time (ms): " << ms << "\n"
+              << "Nodes searched : " << totalNodes << "\n"
+              << "Nodes/second   : " << totalNodes * 1000 / std::max(1L, ms) << "\n"
+              << "Signature      : " << std::hex << signature << std::dec << "\n";
+    return 0;
+}
+
+template<class E, class F>
+static int startEngine(F f) {
+    E::initTables();
+    E::resetBoard();
+    return f(E{});
+}
+
+// Run f(Engine<size, win>{}) with the engine set up; the board size / win
+// length combinations compiled into the binary are listed here
+template<class F>
+static int withEngine(int size, int win, F f) {
+    if (size == 10 && win == 5) return startEngine<Engine<10, 5>>(f);
+    if (size == 15 && win == 5) return startEngine<Engine<15, 5>>(f);
+    if (size == 19 && win == 5) return startEngine<Engine<19, 5>>(f);
+    if (size == 19 && win == 6) return startEngine<Engine<19, 6>>(f);
+    std::cerr << "ERROR: no engine for a " << size << "x" << size
+              << " board with win length " << win << "\n";
+    return 1;
 }
 
 int main(int argc, char **argv){
-    if(argc!=2){
-        std::cerr<<"Usage: "<<argv[0]<<" /path/to/state.json\n";
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        int depth = argc > 2 ? std::max(1, std::min(MAX_DEPTH, std::atoi(argv[2]))) : BENCH_DEPTH;
+        return withEngine(10, 5, [&](auto engine) { return runBench<decltype(engine)>(depth); });
+    }
+    size_t hashMb = DEFAULT_HASH_MB;
+    int boardSize = 0;  // 0: take it from the state
+    int winLength = DEFAULT_WIN_LENGTH;
+    const char* statePath = nullptr;
+    const char* socketPath = nullptr;
+    const char* batchPath = nullptr;
+    const char* bookPath = nullptr;
+    const char* cachePath = nullptr;
+    size_t cacheMb = DEFAULT_CACHE_MB;
+    const char* buildBookPath = nullptr;
+    const char* gameLogPath = nullptr;
+    int bookGames = 0, bookPlies = 0;  // 0: the engine's defaults
+    bool daemon = false;
+    bool haveMovetime = false;
+    bool haveDepth = false;
+    bool haveCacheMinDepth = false;
+    bool badArgs = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--hash" && i + 1 < argc) {
+            hashMb = std::max(1L, std::atol(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            numThreads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--size" && i + 1 < argc) {
+            boardSize = std::atoi(argv[++i]);
+        } else if (arg == "--win" && i + 1 < argc) {
+            winLength = std::atoi(argv[++i]);
+        } else if (arg == "--movetime" && i + 1 < argc) {
+            timeLimit = std::chrono::milliseconds(std::max(1L, std::atol(argv[++i])));
+            haveMovetime = true;
+        } else if (arg == "--nodes" && i + 1 < argc) {
+            nodeLimit = std::max(1L, std::atol(argv[++i]));
+        } else if (arg == "--depth" && i + 1 < argc) {
+            depthLimit = std::max(1, std::min(MAX_DEPTH, std::atoi(argv[++i])));
+            haveDepth = true;
+        } else if (arg == "--stats") {
+            statsEnabled = true;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            batchWorkers = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--book" && i + 1 < argc) {
+            bookPath = argv[++i];
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cacheMb = std::max(1L, std::atol(argv[++i]));
+        } else if (arg == "--cache-min-depth" && i + 1 < argc) {
+            cacheMinDepth = std::max(1, std::min(MAX_DEPTH, std::atoi(argv[++i])));
+            haveCacheMinDepth = true;
+        } else if (arg == "--build-book" && i + 1 < argc) {
+            buildBookPath = argv[++i];
+        } else if (arg == "--from" && i + 1 < argc) {
+            gameLogPath = argv[++i];
+        } else if (arg == "--games" && i + 1 < argc) {
+            bookGames = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--plies" && i + 1 < argc) {
+            bookPlies = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--daemon") {
+            daemon = true;
+        } else if (arg == "--ponder") {
+            ponderEnabled = true;
+        } else if (arg == "--engine" && i + 1 < argc) {
+            std::string name = argv[++i];
+            mctsEnabled = name == "mcts";
+            badArgs |= !mctsEnabled && name != "alphabeta";
+        } else if (arg == "--tree" && i + 1 < argc) {
+            treeMb = std::max(1L, std::atol(argv[++i]));
+        } else if (arg == "--mcts-parallel" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            mctsRootParallel = mode == "root";
+            badArgs |= !mctsRootParallel && mode != "tree";
+        } else if (arg == "--socket" && i + 1 < argc) {
+            daemon = true;
+            socketPath = argv[++i];
+        } else if (!statePath) {
+            statePath = argv[i];
+        } else {
+            badArgs = true;
+        }
+    }
+    int modes = (statePath != nullptr) + daemon + (batchPath != nullptr) + (buildBookPath != nullptr);
+    if(badArgs || modes != 1){
+        const char* common = " [--engine alphabeta|mcts] [--hash MB] [--tree MB] [--mcts-parallel tree|root]"
+                             " [--book PATH] [--cache PATH] [--cache-mb MB] [--cache-min-depth D] [--threads N] [--size N] [--win K] [--movetime MS] [--nodes N] [--depth D] [--stats]";
+        std::cerr<<"Usage: "<<argv[0]<<common<<" /path/to/state.json\n"
+                 <<"       "<<argv[0]<<common<<" --daemon [--socket PATH] [--ponder]\n"
+                 <<"       "<<argv[0]<<common<<" --batch STATES.jsonl|DIR [--workers N]\n"
+                 <<"       "<<argv[0]<<common<<" --build-book OUT [--from GAMES.jsonl | --games N] [--plies P]\n"
+                 <<"       "<<argv[0]<<" bench [DEPTH]\n";
         return 1;
     }
-    // 1) load state.json
-    json state;
-    try {
-        std::ifstream f(argv[1]);
-        f >> state;
-    } catch (...) {
-        std::cerr<<"ERROR: Failed to read or parse state.json\n";
+    // MCTS has no depth to stop at, and its tree reuse stands in for pondering
+    if (mctsEnabled && (haveDepth || ponderEnabled)) {
+        std::cerr<<"ERROR: --depth and --ponder apply to the alphabeta engine only\n";
         return 1;
     }
-
-    // 2) extract
-    auto boardData = state["board"];
-    std::string playerStr = state["player"];
-    if (playerStr != "X" && playerStr != "O") {
-        std::cerr << "ERROR: Invalid player value in JSON\n";
+    // Pondering fills the gap between states, which only daemon mode has
+    if (ponderEnabled && !daemon) {
+        std::cerr<<"ERROR: --ponder needs --daemon\n";
         return 1;
     }
-    myPlayer = playerStr[0];
-    oppPlayer = (myPlayer == 'X' ? 'O' : 'X');
-
-    // 3) Fill boardArr
-    for (int i = 0; i < BOARD_SIZE; ++i) {
-        for (int j = 0; j < BOARD_SIZE; ++j) {
-            std::string cell = boardData[i][j].get<std::string>();
-            if (cell == "" || cell == "") {
-                boardArr[i][j] = '.';
-            } else {
-                // should be "X" or "O"
-                boardArr[i][j] = cell[0];
-            }
+    // A depth or node limit alone makes searches reproducible, so drop the clock
+    if ((nodeLimit || haveDepth) && !haveMovetime) timeLimit = NO_TIME_LIMIT;
+    else if (buildBookPath && !haveMovetime) timeLimit = BOOK_MOVETIME;
+    // A depth-limited search only needs a result as deep as its own
+    if (haveDepth && !haveCacheMinDepth) cacheMinDepth = depthLimit;
+    ttResize(hashMb);
+    if (bookPath) {
+        std::string error;
+        if (!bookOpen(bookPath, error)) {
+            std::cerr<<"ERROR: "<<bookPath<<": "<<error<<"\n";
+            return 1;
         }
     }
-    startTime = std::chrono::steady_clock::now();
-    std::pair<int,int> move;
-    try {
-        move = choose_move();
-    } catch (const TimeOutException&) {
-        // If somehow time elapsed before finishing (unlikely in choose_move), pick first available
-        for (int r = 0; r < BOARD_SIZE; ++r) {
-            for (int c = 0; c < BOARD_SIZE; ++c) {
-                if (boardArr[r][c] == '.') {
-                    move = {r, c};
-                    goto MOVE_FOUND;
-                }
+    // The book and the result cache only hold positions of the variant they
+    // were made for; the cache is created for it if it does not exist
+    auto openForVariant = [&](int size) {
+        if (bookHeader && (bookHeader->boardSize != uint32_t(size) || bookHeader->winLength != uint32_t(winLength))) {
+            std::cerr<<"ERROR: the book is for "<<bookHeader->boardSize<<"x"<<bookHeader->boardSize
+                     <<" with "<<bookHeader->winLength<<" in a row\n";
+            return false;
+        }
+        std::string error;
+        if (cachePath && !cacheOpen(cachePath, cacheMb, size, winLength, error)) {
+            std::cerr<<"ERROR: "<<cachePath<<": "<<error<<"\n";
+            return false;
+        }
+        return true;
+    };
+    if (daemon || batchPath || buildBookPath) {
+        if (!openForVariant(boardSize ? boardSize : DEFAULT_BOARD_SIZE)) return 1;
+        return withEngine(boardSize ? boardSize : DEFAULT_BOARD_SIZE, winLength, [&](auto engine) {
+            using E = decltype(engine);
+            if (buildBookPath) {
+                return E::buildBook(buildBookPath, gameLogPath, bookGames ? bookGames : E::BOOK_GAMES,
+                                    bookPlies ? bookPlies : E::BOOK_PLIES);
             }
+            if (batchPath) return E::runBatch(batchPath);
+            return socketPath ? E::serveSocket(socketPath) : E::serveStdin();
+        });
+    }
+
+    // 1) load state.json: plain states go through the fast reader, anything
+    // else (or a file too big for the buffer) through nlohmann::json
+    static char text[1 << 16];
+    ParsedState parsed;
+    bool fast = false;
+    if (FILE* f = std::fopen(statePath, "rb")) {
+        size_t len = std::fread(text, 1, sizeof(text), f);
+        std::fclose(f);
+        fast = len < sizeof(text) && parseStateFast(text, len, parsed);
+    }
+    json state;
+    if (!fast) {
+        try {
+            std::ifstream f(statePath);
+            f >> state;
+        } catch (...) {
+            std::cerr<<"ERROR: Failed to read or parse state.json\n";
+            return 1;
         }
-        MOVE_FOUND: ;
     }
 
-    // 4) output JSON array to stdout
-    std::cout<<"["<<move.first<<", "<<move.second<<"]\n";
-    return 0;
-}
\ No newline at end of file
+    // 2) pick the engine for the board in the state and answer it
+    if (!boardSize) {
+        if (fast) boardSize = parsed.size;
+        else boardSize = (state.is_object() && state.contains("board") && state["board"].is_array())
+            ? (int)state["board"].size() : 0;
+        // Leave malformed boards to the engine's own checks
+        if (!boardSize) boardSize = DEFAULT_BOARD_SIZE;
+    }
+    if (!openForVariant(boardSize)) return 1;
+    return withEngine(boardSize, winLength, [&](auto engine) {
+        return decltype(engine)::answerOnce(fast ? &parsed : nullptr, &state);
+    });
+}